@@ -0,0 +1,101 @@
+// Contention benchmark of the index publication: readers take the current state in a loop,
+// while the writer replaces it every few milliseconds, as the clustering thread of the server does.
+// Usage: hot_state_bench [duration_ms] [swap_period_ms]
+
+#include "../src/hot_state.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    struct TState {
+        uint64_t Value = 0;
+    };
+
+    // Previous implementation, kept as the baseline
+    class TSharedPtrState {
+    public:
+        std::shared_ptr<TState> AtomicGet() const {
+            return std::atomic_load(&StatePtr);
+        }
+
+        void AtomicSet(std::unique_ptr<TState> newState) {
+            std::atomic_store(&StatePtr, std::shared_ptr<TState>(std::move(newState)));
+        }
+
+    private:
+        std::shared_ptr<TState> StatePtr;
+    };
+
+    template <class TStateHolder>
+    double MeasureReads(size_t readersCount, std::chrono::milliseconds duration, std::chrono::milliseconds swapPeriod) {
+        TStateHolder holder;
+        holder.AtomicSet(std::make_unique<TState>());
+
+        std::atomic<bool> stop {false};
+        std::atomic<uint64_t> checksumSink {0};
+        std::vector<uint64_t> readsCount(readersCount);
+        std::vector<std::thread> readers;
+        for (size_t i = 0; i < readersCount; ++i) {
+            readers.emplace_back([&, i]() {
+                uint64_t reads = 0;
+                uint64_t checksum = 0;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    const auto state = holder.AtomicGet();
+                    checksum += state->Value;
+                    ++reads;
+                }
+                readsCount[i] = reads;
+                checksumSink.fetch_add(checksum);
+            });
+        }
+
+        std::thread writer([&]() {
+            uint64_t generation = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                std::this_thread::sleep_for(swapPeriod);
+                auto state = std::make_unique<TState>();
+                state->Value = ++generation;
+                holder.AtomicSet(std::move(state));
+            }
+        });
+
+        std::this_thread::sleep_for(duration);
+        stop.store(true);
+        for (std::thread& reader : readers) {
+            reader.join();
+        }
+        writer.join();
+
+        uint64_t totalReads = 0;
+        for (uint64_t reads : readsCount) {
+            totalReads += reads;
+        }
+        return static_cast<double>(totalReads) / std::chrono::duration<double>(duration).count();
+    }
+
+}
+
+int main(int argc, char** argv) {
+    const std::chrono::milliseconds duration(argc > 1 ? std::atoi(argv[1]) : 1000);
+    const std::chrono::milliseconds swapPeriod(argc > 2 ? std::atoi(argv[2]) : 10);
+
+    std::cout << std::setw(8) << "readers"
+        << std::setw(20) << "shared_ptr, Mops/s"
+        << std::setw(20) << "epoch, Mops/s" << std::endl;
+    for (size_t readersCount : {6, 8, 16, 32, 64}) {
+        const double sharedPtrReads = MeasureReads<TSharedPtrState>(readersCount, duration, swapPeriod);
+        const double epochReads = MeasureReads<THotState<TState>>(readersCount, duration, swapPeriod);
+        std::cout << std::setw(8) << readersCount
+            << std::setw(20) << std::fixed << std::setprecision(2) << sharedPtrReads / 1e6
+            << std::setw(20) << std::fixed << std::setprecision(2) << epochReads / 1e6 << std::endl;
+    }
+    return 0;
+}
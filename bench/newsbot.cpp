@@ -0,0 +1,567 @@
+// Benchmarks of the offline pipeline stages on synthetic documents. Documents and embeddings are
+// generated from the seed, so the numbers of two builds are comparable. Run from the repository root:
+// configs are read from there, and stages which need missing models are skipped.
+// Usage: newsbot_bench [--filter substring] [--seed N] [--min_time_ms N] [--repetitions N] [--output results.json]
+
+#include "../src/clustering/slink.h"
+#include "../src/clustering/slink_stages.h"
+#include "../src/detect.h"
+#include "../src/document.h"
+#include "../src/embedders/ft_embedder.h"
+#include "../src/embedders/tfidf_embedder.h"
+#include "../src/embedders/token_indexer.h"
+#include "../src/embedders/torch_embedder.h"
+#include "../src/json_writer.h"
+#include "../src/ranker.h"
+#include "../src/summarizer.h"
+#include "../src/thread_pool.h"
+#include "../src/timer.h"
+#include "../src/tokenized_document.h"
+#include "../src/util.h"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <fasttext.h>
+#include <tinyxml2/tinyxml2.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace po = boost::program_options;
+
+namespace {
+
+    template <class T>
+    void DoNotOptimize(const T& value) {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    constexpr size_t EMBEDDING_SIZE = 64;
+    constexpr size_t HOSTS_COUNT = 100;
+    constexpr uint64_t START_TIMESTAMP = 1600000000;
+
+    class TDocumentGenerator {
+    public:
+        explicit TDocumentGenerator(uint64_t seed, size_t vocabularySize = 20000)
+            : Generator(seed)
+        {
+            static const std::string consonants = "bcdfghklmnprstvz";
+            static const std::string vowels = "aeiou";
+            std::vector<double> weights;
+            for (size_t rank = 0; rank < vocabularySize; ++rank) {
+                std::string word;
+                const size_t syllablesCount = 1 + Generator() % 4;
+                for (size_t i = 0; i < syllablesCount; ++i) {
+                    word += consonants[Generator() % consonants.size()];
+                    word += vowels[Generator() % vowels.size()];
+                }
+                Vocabulary.push_back(std::move(word));
+                // Zipf's law, as in natural texts
+                weights.push_back(1.0 / (rank + 1));
+            }
+            WordDistribution = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+        }
+
+        std::string GenerateText(size_t wordsCount) {
+            std::string text;
+            for (size_t i = 0; i < wordsCount; ++i) {
+                text += i == 0 ? "" : (i % 12 == 0 ? ". " : " ");
+                text += Vocabulary[WordDistribution(Generator)];
+            }
+            return text;
+        }
+
+        TDocument GenerateDocument(size_t index, size_t textWords) {
+            TDocument doc;
+            doc.SiteName = "host" + std::to_string(Generator() % HOSTS_COUNT) + ".com";
+            doc.Url = "https://" + doc.SiteName + "/" + std::to_string(index);
+            doc.FileName = std::to_string(index) + ".html";
+            doc.Title = GenerateText(8);
+            doc.Description = GenerateText(20);
+            doc.Text = GenerateText(textWords);
+            doc.FetchTime = START_TIMESTAMP + index * 10;
+            doc.PubTime = doc.FetchTime;
+            return doc;
+        }
+
+        // Same layout as the contest files
+        static std::string GenerateHtml(const TDocument& doc) {
+            const std::string time = FormatTime(doc.PubTime);
+            std::string html = "<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"utf-8\"/>\n";
+            html += "<meta property=\"og:url\" content=\"" + doc.Url + "\"/>\n";
+            html += "<meta property=\"og:site_name\" content=\"" + doc.SiteName + "\"/>\n";
+            html += "<meta property=\"article:published_time\" content=\"" + time + "\"/>\n";
+            html += "<meta property=\"og:title\" content=\"" + doc.Title + "\"/>\n";
+            html += "<meta property=\"og:description\" content=\"" + doc.Description + "\"/>\n";
+            html += "</head>\n<body>\n<article>\n<h1>" + doc.Title + "</h1>\n";
+            html += "<address><time datetime=\"" + time + "\">" + time + "</time></address>\n";
+            for (size_t begin = 0; begin < doc.Text.size();) {
+                const size_t end = std::min(doc.Text.find(". ", begin + 400), doc.Text.size());
+                html += "<p>" + doc.Text.substr(begin, end - begin) + "</p>\n";
+                begin = end + 2;
+            }
+            html += "</article>\n</body>\n</html>\n";
+            return html;
+        }
+
+        // Vocabulary file of the most frequent words in the layout of the TF-IDF ones, "word\tidf" lines after <unk>
+        void WriteVocabulary(const std::string& path, size_t wordsCount) const {
+            std::ofstream output(path);
+            output << "<unk>\t1.0\n";
+            for (size_t rank = 0; rank < std::min(wordsCount, Vocabulary.size()); ++rank) {
+                output << Vocabulary[rank] << "\t" << std::log(2.0 + rank) << "\n";
+            }
+        }
+
+        // The generated words and punctuation are tokens already, the annotator would split the dots off
+        static TTokenizedDocument Tokenize(const TDocument& doc) {
+            std::vector<std::string> titleTokens;
+            std::vector<std::string> textTokens;
+            boost::split(titleTokens, doc.Title, boost::is_any_of(" "), boost::token_compress_on);
+            boost::split(textTokens, doc.Text, boost::is_any_of(" "), boost::token_compress_on);
+            return TTokenizedDocument(titleTokens, textTokens);
+        }
+
+        // Same layout as the JSON dumps read by TDocument::FromJson
+        static nlohmann::json GenerateJson(const TDocument& doc, size_t index) {
+            return {
+                {"id", index},
+                {"published_at", FormatTime(doc.PubTime)},
+                {"url_k", doc.Url},
+                {"source_name_tk", doc.SiteName},
+                {"title_tk", doc.Title},
+                {"body_t", doc.Text}
+            };
+        }
+
+        // Documents are grouped into topics of a few documents, embeddings of a topic are
+        // noisy copies of its center, so that the clustering finds clusters of realistic sizes
+        std::vector<TDbDocument> GenerateDbDocuments(size_t count, const tg::TClusteringConfig& config) {
+            std::normal_distribution<float> normal(0.0f, 1.0f);
+            std::vector<std::vector<float>> centers(std::max<size_t>(count / 4, 1));
+            for (std::vector<float>& center : centers) {
+                for (size_t i = 0; i < EMBEDDING_SIZE; ++i) {
+                    center.push_back(normal(Generator));
+                }
+            }
+
+            std::vector<TDbDocument> docs(count);
+            for (size_t index = 0; index < count; ++index) {
+                TDbDocument& doc = docs[index];
+                doc.Host = "host" + std::to_string(Generator() % HOSTS_COUNT) + ".com";
+                doc.Url = "https://" + doc.Host + "/" + std::to_string(index);
+                doc.FileName = std::to_string(index) + ".html";
+                doc.Title = GenerateText(8);
+                doc.FetchTime = START_TIMESTAMP + index * 10;
+                doc.PubTime = doc.FetchTime;
+                doc.Language = config.language();
+                doc.Category = static_cast<tg::ECategory>(tg::NC_SOCIETY + Generator() % (tg::NC_OTHER - tg::NC_SOCIETY + 1));
+                const std::vector<float>& center = centers[Generator() % centers.size()];
+                for (const auto& keyWeight : config.embedding_keys_weights()) {
+                    std::vector<float> embedding(center);
+                    for (float& value : embedding) {
+                        value += 0.15f * normal(Generator);
+                    }
+                    doc.Embeddings[keyWeight.embedding_key()] = std::move(embedding);
+                }
+            }
+            return docs;
+        }
+
+    private:
+        static std::string FormatTime(uint64_t timestamp) {
+            const std::time_t time = static_cast<std::time_t>(timestamp);
+            std::tm tm {};
+            gmtime_r(&time, &tm);
+            char buffer[32];
+            std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S+00:00", &tm);
+            return buffer;
+        }
+
+    private:
+        std::mt19937_64 Generator;
+        std::vector<std::string> Vocabulary;
+        std::discrete_distribution<size_t> WordDistribution;
+    };
+
+    struct TBenchOptions {
+        uint64_t Seed = 42;
+        std::string AnnotatorConfig;
+        std::string ClustererConfig;
+        std::string SummarizerConfig;
+        std::string RankerConfig;
+    };
+
+    using TIteration = std::function<void()>;
+
+    struct TBenchmark {
+        std::string Name;
+        // Items (documents) processed by one iteration
+        size_t Items = 1;
+        // Generates the data and returns the measured iteration, nullptr if the stage is unavailable
+        std::function<TIteration()> Prepare;
+    };
+
+    struct TBenchResult {
+        std::string Name;
+        size_t Items = 0;
+        size_t Iterations = 0;
+        double MinNs = 0.0;
+        double MedianNs = 0.0;
+        double MeanNs = 0.0;
+    };
+
+    tg::TClusteringConfig GetClusteringConfig(const TBenchOptions& options, size_t docsCount) {
+        tg::TClustererConfig clustererConfig;
+        ::ParseConfig(options.ClustererConfig, clustererConfig);
+        for (const tg::TClusteringConfig& config : clustererConfig.clusterings()) {
+            if (config.language() == tg::LN_EN) {
+                tg::TClusteringConfig result = config;
+                // One batch for all the documents
+                result.set_chunk_size(std::max<uint64_t>(result.chunk_size(), docsCount));
+                result.set_intersection_size(std::min<uint64_t>(result.intersection_size(), result.chunk_size() - 1));
+                return result;
+            }
+        }
+        ENSURE(false, "No clustering config for en");
+    }
+
+    std::unordered_map<tg::EEmbeddingKey, float> GetEmbeddingKeysWeights(const tg::TClusteringConfig& config) {
+        std::unordered_map<tg::EEmbeddingKey, float> weights;
+        for (const auto& keyWeight : config.embedding_keys_weights()) {
+            weights[keyWeight.embedding_key()] = keyWeight.weight();
+        }
+        return weights;
+    }
+
+    // Clusters over their own documents, summarized and sorted as in the index
+    struct TClusteredDocs {
+        std::vector<TDbDocument> Docs;
+        TClusters Clusters;
+    };
+
+    std::shared_ptr<TClusteredDocs> GenerateClusters(const TBenchOptions& options, size_t docsCount, const TSummarizer* summarizer) {
+        const tg::TClusteringConfig config = GetClusteringConfig(options, docsCount);
+        auto result = std::make_shared<TClusteredDocs>();
+        result->Docs = TDocumentGenerator(options.Seed).GenerateDbDocuments(docsCount, config);
+        TSlinkClustering clustering(config);
+        result->Clusters = clustering.Cluster(result->Docs);
+        std::stable_sort(result->Clusters.begin(), result->Clusters.end(),
+            [](const TNewsCluster& a, const TNewsCluster& b) {
+                return a.GetFreshestTimestamp() < b.GetFreshestTimestamp();
+            }
+        );
+        if (summarizer) {
+            summarizer->Summarize(result->Clusters);
+        }
+        return result;
+    }
+
+    std::unique_ptr<TEmbedder> LoadEmbedder(const tg::TEmbedderConfig& config) {
+        if (config.type() == tg::ET_FASTTEXT) {
+            return std::make_unique<TFastTextEmbedder>(config);
+        } else if (config.type() == tg::ET_TORCH) {
+            return std::make_unique<TTorchEmbedder>(config);
+        } else if (config.type() == tg::ET_TFIDF) {
+            return std::make_unique<TTfIdfEmbedder>(config);
+        }
+        ENSURE(false, "Bad embedder type");
+    }
+
+    std::vector<TBenchmark> MakeBenchmarks(const TBenchOptions& options) {
+        std::vector<TBenchmark> benchmarks;
+        constexpr size_t DOCS_PER_ITERATION = 64;
+
+        for (size_t words : {100, 1000}) {
+            benchmarks.push_back({"document/from_html/" + std::to_string(words), DOCS_PER_ITERATION, [=]() -> TIteration {
+                TDocumentGenerator generator(options.Seed);
+                auto htmls = std::make_shared<std::vector<std::string>>();
+                for (size_t i = 0; i < DOCS_PER_ITERATION; ++i) {
+                    htmls->push_back(TDocumentGenerator::GenerateHtml(generator.GenerateDocument(i, words)));
+                }
+                return [htmls]() {
+                    for (const std::string& content : *htmls) {
+                        tinyxml2::XMLDocument html;
+                        html.Parse(content.data(), content.size());
+                        TDocument doc;
+                        doc.FromHtml(html, "bench.html");
+                        DoNotOptimize(doc.Text.size());
+                    }
+                };
+            }});
+            benchmarks.push_back({"document/from_json/" + std::to_string(words), DOCS_PER_ITERATION, [=]() -> TIteration {
+                TDocumentGenerator generator(options.Seed);
+                auto jsons = std::make_shared<std::vector<nlohmann::json>>();
+                for (size_t i = 0; i < DOCS_PER_ITERATION; ++i) {
+                    jsons->push_back(TDocumentGenerator::GenerateJson(generator.GenerateDocument(i, words), i));
+                }
+                return [jsons]() {
+                    for (const nlohmann::json& json : *jsons) {
+                        TDocument doc;
+                        doc.FromJson(json);
+                        DoNotOptimize(doc.Text.size());
+                    }
+                };
+            }});
+        }
+
+        tg::TAnnotatorConfig annotatorConfig;
+        ::ParseConfig(options.AnnotatorConfig, annotatorConfig);
+        for (size_t words : {100, 1000}) {
+            benchmarks.push_back({"detect/language/" + std::to_string(words), DOCS_PER_ITERATION, [=]() -> TIteration {
+                auto model = std::make_shared<fasttext::FastText>();
+                try {
+                    model->loadModel(annotatorConfig.lang_detect());
+                } catch (const std::exception& e) {
+                    LOG_ERROR("No language detector: " << e.what());
+                    return nullptr;
+                }
+                TDocumentGenerator generator(options.Seed);
+                auto docs = std::make_shared<std::vector<TDocument>>();
+                for (size_t i = 0; i < DOCS_PER_ITERATION; ++i) {
+                    docs->push_back(generator.GenerateDocument(i, words));
+                }
+                return [model, docs]() {
+                    for (const TDocument& doc : *docs) {
+                        DoNotOptimize(DetectLanguage(*model, doc));
+                    }
+                };
+            }});
+        }
+
+        constexpr size_t EMBEDDINGS_PER_ITERATION = 16;
+        for (const tg::TEmbedderConfig& embedderConfig : annotatorConfig.embedders()) {
+            const std::string embedderName = ToString(embedderConfig.language()) + "_"
+                + tg::EEmbeddingKey_Name(embedderConfig.embedding_key());
+            for (size_t words : {50, 400}) {
+                benchmarks.push_back({"embedder/" + embedderName + "/" + std::to_string(words), EMBEDDINGS_PER_ITERATION, [=]() -> TIteration {
+                    std::shared_ptr<TEmbedder> embedder;
+                    try {
+                        embedder = LoadEmbedder(embedderConfig);
+                    } catch (const std::exception& e) {
+                        LOG_ERROR("No embedder " << embedderName << ": " << e.what());
+                        return nullptr;
+                    }
+                    TDocumentGenerator generator(options.Seed);
+                    auto docs = std::make_shared<std::vector<TTokenizedDocument>>();
+                    for (size_t i = 0; i < EMBEDDINGS_PER_ITERATION; ++i) {
+                        docs->push_back(TDocumentGenerator::Tokenize(generator.GenerateDocument(i, words)));
+                    }
+                    return [embedder, docs]() {
+                        for (const TTokenizedDocument& doc : *docs) {
+                            DoNotOptimize(embedder->CalcEmbedding(doc).size());
+                        }
+                    };
+                }});
+            }
+        }
+
+        for (size_t words : {50, 400}) {
+            const auto prepareIndexer = [=](auto&& index) -> TIteration {
+                TDocumentGenerator generator(options.Seed);
+                const boost::filesystem::path vocabularyPath = boost::filesystem::temp_directory_path()
+                    / boost::filesystem::unique_path("newsbot_bench_vocabulary_%%%%%%.txt");
+                generator.WriteVocabulary(vocabularyPath.string(), 10000);
+                auto indexer = std::make_shared<TTokenIndexer>(vocabularyPath.string(), words);
+                boost::filesystem::remove(vocabularyPath);
+                auto texts = std::make_shared<std::vector<std::string>>();
+                for (size_t i = 0; i < DOCS_PER_ITERATION; ++i) {
+                    const TDocument doc = generator.GenerateDocument(i, words);
+                    texts->push_back(doc.Title + " " + doc.Text);
+                }
+                return [indexer, texts, index]() {
+                    for (const std::string& text : *texts) {
+                        index(*indexer, text);
+                    }
+                };
+            };
+            benchmarks.push_back({"token_indexer/index/" + std::to_string(words), DOCS_PER_ITERATION, [=]() {
+                return prepareIndexer([](const TTokenIndexer& indexer, const std::string& text) {
+                    DoNotOptimize(indexer.Index(text).size());
+                });
+            }});
+            benchmarks.push_back({"token_indexer/index_torch/" + std::to_string(words), DOCS_PER_ITERATION, [=]() {
+                return prepareIndexer([](const TTokenIndexer& indexer, const std::string& text) {
+                    DoNotOptimize(indexer.IndexTorch(text).size(0));
+                });
+            }});
+        }
+
+        for (size_t docsCount : {1000, 4000}) {
+            benchmarks.push_back({"slink/calc_distances/" + std::to_string(docsCount), docsCount, [=]() -> TIteration {
+                const tg::TClusteringConfig config = GetClusteringConfig(options, docsCount);
+                auto docs = std::make_shared<std::vector<TDbDocument>>(TDocumentGenerator(options.Seed).GenerateDbDocuments(docsCount, config));
+                auto distances = std::make_shared<Eigen::MatrixXf>(docsCount, docsCount);
+                return [docs, distances, weights = GetEmbeddingKeysWeights(config)]() {
+                    CalcSlinkDistances(docs->cbegin(), docs->cend(), weights, 0, *distances);
+                    DoNotOptimize(distances->data());
+                };
+            }});
+            // The batch uses the distances as a scratch buffer, so their copy is measured too
+            benchmarks.push_back({"slink/cluster_batch/" + std::to_string(docsCount), docsCount, [=]() -> TIteration {
+                const tg::TClusteringConfig config = GetClusteringConfig(options, docsCount);
+                auto docs = std::make_shared<std::vector<TDbDocument>>(TDocumentGenerator(options.Seed).GenerateDbDocuments(docsCount, config));
+                auto distances = std::make_shared<Eigen::MatrixXf>(docsCount, docsCount);
+                CalcSlinkDistances(docs->cbegin(), docs->cend(), GetEmbeddingKeysWeights(config), 0, *distances);
+                auto scratch = std::make_shared<Eigen::MatrixXf>(docsCount, docsCount);
+                return [config, docs, distances, scratch]() {
+                    *scratch = *distances;
+                    DoNotOptimize(ClusterSlinkBatch(config, docs->cbegin(), docs->cend(), *scratch).size());
+                };
+            }});
+        }
+
+        for (size_t docsCount : {1000, 10000}) {
+            benchmarks.push_back({"summarizer/summarize/" + std::to_string(docsCount), docsCount, [=]() -> TIteration {
+                auto summarizer = std::make_shared<TSummarizer>(options.SummarizerConfig);
+                auto clusters = GenerateClusters(options, docsCount, nullptr);
+                return [summarizer, clusters]() {
+                    summarizer->Summarize(clusters->Clusters);
+                    DoNotOptimize(clusters->Clusters.data());
+                };
+            }});
+            benchmarks.push_back({"ranker/rank/" + std::to_string(docsCount), docsCount, [=]() -> TIteration {
+                const TSummarizer summarizer(options.SummarizerConfig);
+                auto ranker = std::make_shared<TRanker>(options.RankerConfig);
+                auto clusters = GenerateClusters(options, docsCount, &summarizer);
+                const uint64_t iterTimestamp = START_TIMESTAMP + docsCount * 10;
+                return [ranker, clusters, iterTimestamp]() {
+                    const TClusters& allClusters = clusters->Clusters;
+                    DoNotOptimize(ranker->Rank(allClusters.begin(), allClusters.end(), iterTimestamp, 3600 * 24).size());
+                };
+            }});
+        }
+        return benchmarks;
+    }
+
+    // Iterations are repeated until the time of a repetition is reached, the repetitions give the spread
+    TBenchResult Measure(const TBenchmark& benchmark, const TIteration& iteration, std::chrono::milliseconds minTime, size_t repetitions) {
+        iteration();
+
+        const double repetitionNs = std::chrono::duration<double, std::nano>(minTime).count() / repetitions;
+        std::vector<double> iterationNs;
+        size_t iterations = 0;
+        for (size_t repetition = 0; repetition < repetitions; ++repetition) {
+            TTimer<std::chrono::steady_clock, std::chrono::nanoseconds> timer;
+            size_t repetitionIterations = 0;
+            do {
+                iteration();
+                ++repetitionIterations;
+            } while (timer.Elapsed() < repetitionNs);
+            iterationNs.push_back(timer.Elapsed() / repetitionIterations);
+            iterations += repetitionIterations;
+        }
+        std::sort(iterationNs.begin(), iterationNs.end());
+
+        TBenchResult result;
+        result.Name = benchmark.Name;
+        result.Items = benchmark.Items;
+        result.Iterations = iterations;
+        result.MinNs = iterationNs.front();
+        result.MedianNs = iterationNs[iterationNs.size() / 2];
+        result.MeanNs = std::accumulate(iterationNs.begin(), iterationNs.end(), 0.0) / iterationNs.size();
+        return result;
+    }
+
+    std::string SerializeResults(const std::vector<TBenchResult>& results, const TBenchOptions& options, std::chrono::milliseconds minTime, size_t repetitions) {
+        std::string output;
+        TJsonWriter writer(output, 4);
+        writer.BeginObject()
+            .Key("context").BeginObject()
+                .Key("seed").Int(options.Seed)
+                .Key("min_time_ms").Int(minTime.count())
+                .Key("repetitions").Int(repetitions)
+                .Key("threads").Int(TThreadPool::GetShared().GetThreadsCount())
+                .Key("timestamp").Int(std::time(nullptr))
+                .EndObject()
+            .Key("benchmarks").BeginArray();
+        for (const TBenchResult& result : results) {
+            writer.BeginObject()
+                .Key("name").String(result.Name)
+                .Key("items").Int(result.Items)
+                .Key("iterations").Int(result.Iterations)
+                .Key("min_ns").Double(result.MinNs)
+                .Key("median_ns").Double(result.MedianNs)
+                .Key("mean_ns").Double(result.MeanNs)
+                .Key("items_per_second").Double(result.Items * 1e9 / result.MedianNs)
+                .EndObject();
+        }
+        writer.EndArray().EndObject();
+        return output;
+    }
+
+}
+
+int main(int argc, char** argv) {
+    try {
+        po::options_description desc("options");
+        desc.add_options()
+            ("filter", po::value<std::string>()->default_value(""), "filter")
+            ("seed", po::value<uint64_t>()->default_value(42), "seed")
+            ("min_time_ms", po::value<uint64_t>()->default_value(1000), "min_time_ms")
+            ("repetitions", po::value<size_t>()->default_value(5), "repetitions")
+            ("output", po::value<std::string>()->default_value(""), "output")
+            ("annotator_config", po::value<std::string>()->default_value("configs/annotator.pbtxt"), "annotator_config")
+            ("clusterer_config", po::value<std::string>()->default_value("configs/clusterer.pbtxt"), "clusterer_config")
+            ("summarizer_config", po::value<std::string>()->default_value("configs/summarizer.pbtxt"), "summarizer_config")
+            ("ranker_config", po::value<std::string>()->default_value("configs/ranker.pbtxt"), "ranker_config")
+            ;
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+
+        TBenchOptions options;
+        options.Seed = vm["seed"].as<uint64_t>();
+        options.AnnotatorConfig = vm["annotator_config"].as<std::string>();
+        options.ClustererConfig = vm["clusterer_config"].as<std::string>();
+        options.SummarizerConfig = vm["summarizer_config"].as<std::string>();
+        options.RankerConfig = vm["ranker_config"].as<std::string>();
+        const std::string filter = vm["filter"].as<std::string>();
+        const std::chrono::milliseconds minTime(vm["min_time_ms"].as<uint64_t>());
+        const size_t repetitions = std::max<size_t>(vm["repetitions"].as<size_t>(), 1);
+
+        std::cout << std::left << std::setw(48) << "benchmark"
+            << std::right << std::setw(16) << "median, ms"
+            << std::setw(16) << "min, ms"
+            << std::setw(16) << "items/s" << std::endl;
+        std::vector<TBenchResult> results;
+        for (const TBenchmark& benchmark : MakeBenchmarks(options)) {
+            if (benchmark.Name.find(filter) == std::string::npos) {
+                continue;
+            }
+            const TIteration iteration = benchmark.Prepare();
+            if (!iteration) {
+                std::cout << std::left << std::setw(48) << benchmark.Name << "skipped" << std::endl;
+                continue;
+            }
+            const TBenchResult& result = results.emplace_back(Measure(benchmark, iteration, minTime, repetitions));
+            std::cout << std::left << std::setw(48) << result.Name << std::right << std::fixed << std::setprecision(3)
+                << std::setw(16) << result.MedianNs / 1e6
+                << std::setw(16) << result.MinNs / 1e6
+                << std::setw(16) << std::setprecision(0) << result.Items * 1e9 / result.MedianNs << std::endl;
+        }
+
+        const std::string outputPath = vm["output"].as<std::string>();
+        if (!outputPath.empty()) {
+            std::ofstream output(outputPath);
+            output << SerializeResults(results, options, minTime, repetitions) << std::endl;
+            ENSURE(output, "Could not write " + outputPath);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+    return 0;
+}
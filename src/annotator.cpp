@@ -4,16 +4,48 @@
 #include "embedders/ft_embedder.h"
 #include "embedders/tfidf_embedder.h"
 #include "embedders/torch_embedder.h"
+#include "executor.h"
+#include "metrics.h"
 #include "nasty.h"
 #include "thread_pool.h"
+#include "trace.h"
 #include "timer.h"
 #include "util.h"
 
-#include <boost/algorithm/string/join.hpp>
 #include <tinyxml2/tinyxml2.h>
 
 #include <optional>
 
+namespace {
+
+    struct TAnnotatorMetrics {
+        THistogram& Parse;
+        THistogram& DetectLanguage;
+        THistogram& Preprocess;
+        THistogram& DetectCategory;
+        THistogram& Embed;
+    };
+
+    THistogram& GetStageHistogram(const std::string& stage) {
+        return TMetricsRegistry::Get().GetHistogram(
+            "newsbot_annotator_stage_duration_seconds",
+            "Time spent in the document annotation stages",
+            {{"stage", stage}});
+    }
+
+    const TAnnotatorMetrics& GetAnnotatorMetrics() {
+        static const TAnnotatorMetrics metrics = {
+            GetStageHistogram("parse"),
+            GetStageHistogram("detect_language"),
+            GetStageHistogram("preprocess"),
+            GetStageHistogram("detect_category"),
+            GetStageHistogram("embed")
+        };
+        return metrics;
+    }
+
+}
+
 static std::unique_ptr<TEmbedder> LoadEmbedder(tg::TEmbedderConfig config) {
     if (config.type() == tg::ET_FASTTEXT) {
         return std::make_unique<TFastTextEmbedder>(config);
@@ -40,6 +72,7 @@ TAnnotator::TAnnotator(
     SaveTexts = Config.save_texts() || (Mode == "json");
     SaveNotNews = Config.save_not_news() || SaveNotNews;
     ComputeNasty = Config.compute_nasty();
+    ConfigureExecutor(Config.executor());
 
     LOG_DEBUG("Loading models...");
 
@@ -75,9 +108,10 @@ std::vector<TDbDocument> TAnnotator::AnnotateAll(
     const std::vector<std::string>& fileNames,
     tg::EInputFormat inputFormat) const
 {
-    TThreadPool threadPool;
+    TThreadPool& threadPool = TThreadPool::GetShared();
     std::vector<TDbDocument> docs;
-    std::vector<std::future<std::optional<TDbDocument>>> futures;
+    std::vector<std::optional<TDbDocument>> annotatedDocs;
+    const auto annotateDocument = [this](const TDocument& parsedDoc) { return AnnotateDocument(parsedDoc); };
     nlohmann::json json;
     nlohmann::json  item;
     if (inputFormat == tg::IF_JSON) {
@@ -101,10 +135,7 @@ std::vector<TDbDocument> TAnnotator::AnnotateAll(
 
         parsedDocs.shrink_to_fit();
         docs.reserve(parsedDocs.size());
-        futures.reserve(parsedDocs.size());
-        for (const TDocument& parsedDoc: parsedDocs) {
-            futures.push_back(threadPool.enqueue(&TAnnotator::AnnotateDocument, this, parsedDoc));
-        }
+        annotatedDocs = threadPool.ParallelMap(parsedDocs, annotateDocument);
     } else if (inputFormat == tg::IF_JSONL) {
         std::vector<TDocument> parsedDocs;
         for (const std::string& path: fileNames) {
@@ -118,22 +149,14 @@ std::vector<TDbDocument> TAnnotator::AnnotateAll(
         }
         parsedDocs.shrink_to_fit();
         docs.reserve(parsedDocs.size());
-        futures.reserve(parsedDocs.size());
-        for (const TDocument& parsedDoc: parsedDocs) {
-            futures.push_back(threadPool.enqueue(&TAnnotator::AnnotateDocument, this, parsedDoc));
-        }
+        annotatedDocs = threadPool.ParallelMap(parsedDocs, annotateDocument);
     } else if (inputFormat == tg::IF_HTML) {
         docs.reserve(fileNames.size());
-        futures.reserve(fileNames.size());
-        for (const std::string& path: fileNames) {
-            using TFunc = std::optional<TDbDocument>(TAnnotator::*)(const std::string&) const;
-            futures.push_back(threadPool.enqueue<TFunc>(&TAnnotator::AnnotateHtml, this, path));
-        }
+        annotatedDocs = threadPool.ParallelMap(fileNames, [this](const std::string& path) { return AnnotateHtml(path); });
     } else {
         ENSURE(false, "Bad input format");
     }
-    for (auto& futureDoc : futures) {
-        std::optional<TDbDocument> doc = futureDoc.get();
+    for (std::optional<TDbDocument>& doc : annotatedDocs) {
         if (!doc) {
             continue;
         }
@@ -152,7 +175,7 @@ std::vector<TDbDocument> TAnnotator::AnnotateAll(
 
         docs.push_back(std::move(doc.value()));
     }
-    futures.clear();
+    annotatedDocs.clear();
     docs.shrink_to_fit();
     return docs;
 }
@@ -168,8 +191,14 @@ std::optional<TDbDocument> TAnnotator::AnnotateHtml(const tinyxml2::XMLDocument&
 }
 
 std::optional<TDbDocument> TAnnotator::AnnotateDocument(const TDocument& document) const {
+    TTraceSpan span("annotate_document");
+    const TAnnotatorMetrics& metrics = GetAnnotatorMetrics();
     TDbDocument dbDoc;
-    dbDoc.Language = DetectLanguage(LanguageDetector, document);
+    {
+        TTraceSpan languageSpan("detect_language");
+        TScopedLatency latency(metrics.DetectLanguage);
+        dbDoc.Language = DetectLanguage(LanguageDetector, document);
+    }
     dbDoc.Url = document.Url;
     dbDoc.Host = GetHost(dbDoc.Url);
     dbDoc.SiteName = document.SiteName;
@@ -192,21 +221,31 @@ std::optional<TDbDocument> TAnnotator::AnnotateDocument(const TDocument& documen
         return dbDoc;
     }
 
-    std::string cleanTitle = PreprocessText(document.Title);
-    std::string cleanText = PreprocessText(document.Text);
+    TTokenizedDocument tokenizedDocument;
+    {
+        TTraceSpan preprocessSpan("preprocess");
+        TScopedLatency latency(metrics.Preprocess);
+        tokenizedDocument = Tokenize(document);
+    }
 
     auto detectorIt = CategoryDetectors.find(dbDoc.Language);
     if (detectorIt != CategoryDetectors.end()) {
         const auto& detector = detectorIt->second;
-        dbDoc.Category = DetectCategory(detector, cleanTitle, cleanText);
+        TTraceSpan categorySpan("detect_category");
+        TScopedLatency latency(metrics.DetectCategory);
+        dbDoc.Category = DetectCategory(detector, tokenizedDocument);
     }
-    for (const auto& [pair, embedder]: Embedders) {
-        const auto& [language, embeddingKey] = pair;
-        if (language != dbDoc.Language) {
-            continue;
+    {
+        TTraceSpan embedSpan("embed");
+        TScopedLatency latency(metrics.Embed);
+        for (const auto& [pair, embedder]: Embedders) {
+            const auto& [language, embeddingKey] = pair;
+            if (language != dbDoc.Language) {
+                continue;
+            }
+            TDbDocument::TEmbedding value = embedder->CalcEmbedding(tokenizedDocument);
+            dbDoc.Embeddings.emplace(embeddingKey, std::move(value));
         }
-        TDbDocument::TEmbedding value = embedder->CalcEmbedding(cleanTitle, cleanText);
-        dbDoc.Embeddings.emplace(embeddingKey, std::move(value));
     }
     if (ComputeNasty) {
         dbDoc.Nasty = ComputeDocumentNasty(dbDoc);
@@ -216,6 +255,8 @@ std::optional<TDbDocument> TAnnotator::AnnotateDocument(const TDocument& documen
 }
 
 std::optional<TDocument> TAnnotator::ParseHtml(const std::string& path) const {
+    TTraceSpan span("parse_html");
+    TScopedLatency latency(GetAnnotatorMetrics().Parse);
     TDocument doc;
     try {
         doc.FromHtml(path.c_str(), Config.parse_links());
@@ -227,6 +268,8 @@ std::optional<TDocument> TAnnotator::ParseHtml(const std::string& path) const {
 }
 
 std::optional<TDocument> TAnnotator::ParseHtml(const tinyxml2::XMLDocument& html, const std::string& fileName) const {
+    TTraceSpan span("parse_html");
+    TScopedLatency latency(GetAnnotatorMetrics().Parse);
     TDocument doc;
     try {
         doc.FromHtml(html, fileName, Config.parse_links());
@@ -237,8 +280,10 @@ std::optional<TDocument> TAnnotator::ParseHtml(const tinyxml2::XMLDocument& html
     return doc;
 }
 
-std::string TAnnotator::PreprocessText(const std::string& text) const {
-    std::vector<std::string> tokens;
-    Tokenizer.tokenize(text, tokens);
-    return boost::join(tokens, " ");
+TTokenizedDocument TAnnotator::Tokenize(const TDocument& document) const {
+    std::vector<std::string> titleTokens;
+    std::vector<std::string> textTokens;
+    Tokenizer.tokenize(document.Title, titleTokens);
+    Tokenizer.tokenize(document.Text, textTokens);
+    return TTokenizedDocument(titleTokens, textTokens);
 }
@@ -3,6 +3,7 @@
 #include "config.pb.h"
 #include "db_document.h"
 #include "embedders/embedder.h"
+#include "tokenized_document.h"
 
 #include <memory>
 #include <optional>
@@ -40,7 +41,7 @@ private:
     std::optional<TDocument> ParseHtml(const std::string& path) const;
     std::optional<TDocument> ParseHtml(const tinyxml2::XMLDocument& html, const std::string& fileName) const;
 
-    std::string PreprocessText(const std::string& text) const;
+    TTokenizedDocument Tokenize(const TDocument& document) const;
 
 private:
     tg::TAnnotatorConfig Config;
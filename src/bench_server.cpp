@@ -0,0 +1,227 @@
+#include "bench_server.h"
+
+#include "json_writer.h"
+#include "util.h"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <drogon/HttpClient.h>
+#include <trantor/net/EventLoopThread.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+
+namespace {
+
+    enum ERequestKind {
+        RK_PUT = 0,
+        RK_POST = 1,
+        RK_DELETE = 2,
+        RK_THREADS = 3,
+        RK_COUNT = 4
+    };
+
+    const std::array<std::string, RK_COUNT> REQUEST_KIND_NAMES = {"put", "post", "delete", "threads"};
+    const std::array<std::string, 2> LANGUAGES = {"ru", "en"};
+    const std::array<std::string, 8> CATEGORIES = {
+        "any", "society", "economy", "technology", "sports", "entertainment", "science", "other"
+    };
+    constexpr uint64_t MIN_TTL = 5 * 60;
+    constexpr uint64_t MAX_TTL = 30 * 24 * 60 * 60;
+    constexpr uint64_t MIN_PERIOD = 5 * 60;
+    constexpr uint64_t MAX_PERIOD = 24 * 60 * 60;
+
+    using TClock = std::chrono::steady_clock;
+
+    std::array<double, RK_COUNT> ParseMix(const std::string& mix) {
+        std::array<double, RK_COUNT> shares = {};
+        std::vector<std::string> items;
+        boost::split(items, mix, boost::is_any_of(","));
+        for (const std::string& item : items) {
+            std::vector<std::string> parts;
+            boost::split(parts, item, boost::is_any_of(":"));
+            ENSURE(parts.size() == 2, "Bad request mix: " << mix);
+            const auto kindIt = std::find(REQUEST_KIND_NAMES.begin(), REQUEST_KIND_NAMES.end(), parts[0]);
+            ENSURE(kindIt != REQUEST_KIND_NAMES.end(), "Unknown request kind: " << parts[0]);
+            shares[std::distance(REQUEST_KIND_NAMES.begin(), kindIt)] = std::stod(parts[1]);
+        }
+        ENSURE(std::any_of(shares.begin(), shares.end(), [](double share) { return share > 0.0; }), "Empty request mix");
+        return shares;
+    }
+
+    struct TArticle {
+        std::string Name;
+        std::string Content;
+    };
+
+    std::vector<TArticle> ReadArticles(const std::vector<std::string>& fileNames) {
+        std::vector<TArticle> articles;
+        articles.reserve(fileNames.size());
+        for (const std::string& fileName : fileNames) {
+            std::ifstream input(fileName);
+            std::ostringstream content;
+            content << input.rdbuf();
+            articles.push_back({boost::filesystem::path(fileName).filename().string(), content.str()});
+        }
+        return articles;
+    }
+
+    // Responses are recorded by the event loop thread, the report is made by the sending one
+    class TLatencyRecorder {
+    public:
+        void Record(ERequestKind kind, uint64_t latencyUs, bool success) {
+            std::lock_guard<std::mutex> lock(Mutex);
+            Latencies[kind].push_back(latencyUs);
+            Errors[kind] += success ? 0 : 1;
+            ++Completed;
+        }
+
+        size_t GetCompleted() const {
+            std::lock_guard<std::mutex> lock(Mutex);
+            return Completed;
+        }
+
+        // Sorted latencies and the errors count
+        std::pair<std::vector<uint64_t>, uint64_t> Get(ERequestKind kind) const {
+            std::lock_guard<std::mutex> lock(Mutex);
+            std::vector<uint64_t> latencies = Latencies[kind];
+            std::sort(latencies.begin(), latencies.end());
+            return {std::move(latencies), Errors[kind]};
+        }
+
+    private:
+        mutable std::mutex Mutex;
+        std::array<std::vector<uint64_t>, RK_COUNT> Latencies;
+        std::array<uint64_t, RK_COUNT> Errors = {};
+        size_t Completed = 0;
+    };
+
+    double GetPercentileMs(const std::vector<uint64_t>& sortedLatencies, double percentile) {
+        if (sortedLatencies.empty()) {
+            return 0.0;
+        }
+        const size_t rank = static_cast<size_t>(std::ceil(percentile * sortedLatencies.size()));
+        return sortedLatencies[std::clamp<size_t>(rank, 1, sortedLatencies.size()) - 1] / 1000.0;
+    }
+
+}
+
+int RunServerBench(const std::vector<std::string>& fileNames, const TServerBenchOptions& options) {
+    ENSURE(!fileNames.empty(), "No html files for the requests");
+    ENSURE(options.Rate > 0.0 && options.Connections > 0, "Bad load options");
+    const std::array<double, RK_COUNT> shares = ParseMix(options.Mix);
+    const std::vector<TArticle> articles = ReadArticles(fileNames);
+
+    trantor::EventLoopThread loopThread;
+    loopThread.run();
+    std::vector<drogon::HttpClientPtr> clients;
+    for (size_t i = 0; i < options.Connections; ++i) {
+        clients.push_back(drogon::HttpClient::newHttpClient(options.Url, loopThread.getLoop()));
+    }
+
+    std::mt19937_64 generator(options.Seed);
+    std::exponential_distribution<double> interArrival(options.Rate);
+    std::discrete_distribution<size_t> kindDistribution(shares.begin(), shares.end());
+    std::uniform_int_distribution<uint64_t> ttlDistribution(MIN_TTL, MAX_TTL);
+    std::uniform_int_distribution<uint64_t> periodDistribution(MIN_PERIOD, MAX_PERIOD);
+
+    // Shared with the callbacks, which may outlive this function if the server does not answer
+    const auto recorder = std::make_shared<TLatencyRecorder>();
+    std::array<uint64_t, RK_COUNT> sent = {};
+    size_t sentTotal = 0;
+    size_t articleIndex = 0;
+    std::deque<std::string> putNames;
+    TClock::duration maxDispatchLag {0};
+
+    const TClock::time_point start = TClock::now();
+    const TClock::time_point end = start + std::chrono::seconds(options.DurationSec);
+    TClock::time_point planned = start;
+    while (true) {
+        planned += std::chrono::duration_cast<TClock::duration>(std::chrono::duration<double>(interArrival(generator)));
+        if (planned >= end) {
+            break;
+        }
+        std::this_thread::sleep_until(planned);
+        maxDispatchLag = std::max(maxDispatchLag, TClock::now() - planned);
+
+        ERequestKind kind = static_cast<ERequestKind>(kindDistribution(generator));
+        if (kind == RK_DELETE && putNames.empty()) {
+            kind = RK_PUT;
+        }
+        auto request = drogon::HttpRequest::newHttpRequest();
+        if (kind == RK_PUT || kind == RK_POST) {
+            const TArticle& article = articles[articleIndex++ % articles.size()];
+            request->setMethod(kind == RK_PUT ? drogon::Put : drogon::Post);
+            request->setPath("/" + article.Name);
+            request->addHeader("Cache-Control", "max-age=" + std::to_string(ttlDistribution(generator)));
+            request->setContentTypeCode(drogon::CT_TEXT_HTML);
+            request->setBody(article.Content);
+            if (kind == RK_PUT) {
+                putNames.push_back(article.Name);
+            }
+        } else if (kind == RK_DELETE) {
+            request->setMethod(drogon::Delete);
+            request->setPath("/" + putNames.front());
+            putNames.pop_front();
+        } else {
+            request->setMethod(drogon::Get);
+            request->setPath("/threads");
+            request->setParameter("period", std::to_string(periodDistribution(generator)));
+            request->setParameter("lang_code", LANGUAGES[generator() % LANGUAGES.size()]);
+            request->setParameter("category", CATEGORIES[generator() % CATEGORIES.size()]);
+        }
+
+        clients[sentTotal % clients.size()]->sendRequest(request,
+            [recorder, kind, planned](drogon::ReqResult result, const drogon::HttpResponsePtr& response) {
+                const auto latency = std::chrono::duration_cast<std::chrono::microseconds>(TClock::now() - planned);
+                const bool success = result == drogon::ReqResult::Ok && response && response->statusCode() < 500;
+                recorder->Record(kind, latency.count(), success);
+            });
+        ++sent[kind];
+        ++sentTotal;
+    }
+
+    const TClock::time_point drainEnd = TClock::now() + std::chrono::seconds(options.DrainTimeoutSec);
+    while (recorder->GetCompleted() < sentTotal && TClock::now() < drainEnd) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    const double durationSec = static_cast<double>(options.DurationSec);
+    std::string output;
+    TJsonWriter writer(output, 4);
+    writer.BeginObject()
+        .Key("connections").Int(options.Connections)
+        .Key("duration_s").Int(options.DurationSec)
+        .Key("max_dispatch_lag_ms").Double(std::chrono::duration<double, std::milli>(maxDispatchLag).count())
+        .Key("requests").BeginObject();
+    for (size_t kindIndex = 0; kindIndex < RK_COUNT; ++kindIndex) {
+        if (sent[kindIndex] == 0) {
+            continue;
+        }
+        const auto [latencies, errors] = recorder->Get(static_cast<ERequestKind>(kindIndex));
+        writer.Key(REQUEST_KIND_NAMES[kindIndex]).BeginObject()
+            .Key("errors").Int(errors)
+            .Key("max_ms").Double(latencies.empty() ? 0.0 : latencies.back() / 1000.0)
+            .Key("p50_ms").Double(GetPercentileMs(latencies, 0.5))
+            .Key("p999_ms").Double(GetPercentileMs(latencies, 0.999))
+            .Key("p99_ms").Double(GetPercentileMs(latencies, 0.99))
+            .Key("sent").Int(sent[kindIndex])
+            .Key("throughput_rps").Double((latencies.size() - errors) / durationSec)
+            .Key("unfinished").Int(sent[kindIndex] - latencies.size())
+            .EndObject();
+    }
+    writer.EndObject()
+        .Key("sent_rps").Double(sentTotal / durationSec)
+        .Key("target_rps").Double(options.Rate)
+        .EndObject();
+    std::cout << output << std::endl;
+    return 0;
+}
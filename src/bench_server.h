@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct TServerBenchOptions {
+    std::string Url = "http://127.0.0.1:8000";
+    // Requests per second, arrivals form a Poisson process
+    double Rate = 100.0;
+    uint64_t DurationSec = 30;
+    // How long the requests still running after the duration are waited for
+    uint64_t DrainTimeoutSec = 10;
+    size_t Connections = 16;
+    // Shares of the request kinds
+    std::string Mix = "put:50,post:10,delete:10,threads:30";
+    uint64_t Seed = 42;
+};
+
+// Replays a mix of PUT, POST, DELETE and /threads requests made of the html files against a running server
+// and prints throughput and latency percentiles of every kind as JSON.
+// The load is open loop: requests are sent at the planned times regardless of the responses, and latency
+// is counted from the planned time, so a stalled server shows up in the tail instead of slowing the client.
+int RunServerBench(const std::vector<std::string>& fileNames, const TServerBenchOptions& options);
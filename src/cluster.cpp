@@ -1,6 +1,7 @@
 #include "cluster.h"
 
 #include "agency_rating.h"
+#include "json_writer.h"
 #include "util.h"
 
 #include <boost/range/algorithm/nth_element.hpp>
@@ -12,8 +13,8 @@
 #include <vector>
 
 void TNewsCluster::AddDocument(const TDbDocument& document) {
-    Documents.push_back(std::move(document));
-    FreshestTimestamp = std::max(FreshestTimestamp, static_cast<uint64_t>(Documents.back().FetchTime));
+    Documents.emplace_back(document);
+    FreshestTimestamp = std::max(FreshestTimestamp, static_cast<uint64_t>(document.FetchTime));
 }
 
 uint64_t TNewsCluster::GetTimestamp(float percentile) const {
@@ -31,11 +32,11 @@ uint64_t TNewsCluster::GetTimestamp(float percentile) const {
 void TNewsCluster::Summarize(const TAgencyRating& agencyRating) {
     assert(GetSize() != 0);
     const auto embeddingKey = (GetLanguage() == tg::LN_RU ? tg::EK_FASTTEXT_TITLE : tg::EK_FASTTEXT_CLASSIC);
-    const size_t embeddingSize = Documents.back().Embeddings.at(embeddingKey).size();
+    const size_t embeddingSize = Documents.back().get().Embeddings.at(embeddingKey).size();
     Eigen::MatrixXf points(GetSize(), embeddingSize);
     for (size_t i = 0; i < GetSize(); i++) {
-        auto embedding = Documents[i].Embeddings.at(embeddingKey);
-        Eigen::Map<Eigen::VectorXf, Eigen::Unaligned> eigenVector(embedding.data(), embedding.size());
+        const auto& embedding = Documents[i].get().Embeddings.at(embeddingKey);
+        Eigen::Map<const Eigen::VectorXf, Eigen::Unaligned> eigenVector(embedding.data(), embedding.size());
         points.row(i) = eigenVector / eigenVector.norm();
     }
     Eigen::MatrixXf docsCosine = points * points.transpose();
@@ -60,7 +61,7 @@ void TNewsCluster::Summarize(const TAgencyRating& agencyRating) {
 
 void TNewsCluster::CalcFeatures(
     const TAlexaAgencyRating& alexaRating,
-    const std::vector<TDbDocument>& docs)
+    const TDbDocumentRefs& docs)
 {
     Features.reserve(3*4*6 + 2*4*6);
     const char* codes[] = {"US", "GB", "IN", "RU", "CA", "AU"};
@@ -94,7 +95,7 @@ void TNewsCluster::CalcFeatures(
 
 TSliceFeatures TNewsCluster::CalcImportance(
     const TAlexaAgencyRating& alexaRating,
-    const std::vector<TDbDocument>& docs,
+    const TDbDocumentRefs& docs,
     tg::ELanguage language,
     ERatingType type,
     double shift,
@@ -160,7 +161,7 @@ TSliceFeatures TNewsCluster::CalcImportance(
 }
 
 void TNewsCluster::CalcImportance(const TAlexaAgencyRating& alexaRating) {
-    auto docs = GetDocuments();
+    TDbDocumentRefs docs = GetDocuments();
     std::stable_sort(docs.begin(), docs.end(), [](const TDbDocument& p1, const TDbDocument& p2) {
         if (p1.FetchTime != p2.FetchTime) {
             return p1.FetchTime < p2.FetchTime;
@@ -187,24 +188,33 @@ void TNewsCluster::CalcCategory() {
     Category = static_cast<tg::ECategory>(std::distance(categoryCount.begin(), it));
 }
 
+void TNewsCluster::SerializeArticles() {
+    ArticlesJson.clear();
+    TJsonWriter writer(ArticlesJson);
+    writer.BeginArray();
+    for (const TDbDocument& doc : Documents) {
+        writer.String(CleanFileName(doc.FileName));
+    }
+    writer.EndArray();
+}
+
 void TNewsCluster::SortByWeights(const std::vector<double>& weights) {
-    std::vector<std::pair<TDbDocument, double>> weightedDocs;
+    std::vector<std::pair<TDbDocumentRef, double>> weightedDocs;
     weightedDocs.reserve(Documents.size());
     for (size_t i = 0; i < Documents.size(); i++) {
-        weightedDocs.emplace_back(std::move(Documents[i]), weights[i]);
+        weightedDocs.emplace_back(Documents[i], weights[i]);
     }
-    Documents.clear();
     std::stable_sort(weightedDocs.begin(), weightedDocs.end(), [](
-        const std::pair<TDbDocument, double>& a,
-        const std::pair<TDbDocument, double>& b)
+        const std::pair<TDbDocumentRef, double>& a,
+        const std::pair<TDbDocumentRef, double>& b)
     {
         if (std::abs(a.second - b.second) < 0.000001) {
-            return a.first.Title < b.first.Title;
+            return a.first.get().Title < b.first.get().Title;
         }
         return a.second > b.second;
     });
-    for (const auto& [doc, _] : weightedDocs) {
-        AddDocument(doc);
+    for (size_t i = 0; i < weightedDocs.size(); i++) {
+        Documents[i] = weightedDocs[i].first;
     }
 }
 
@@ -219,3 +229,18 @@ bool TNewsCluster::Compare(const TNewsCluster& cluster, uint64_t timestamp) {
     return cluster.FreshestTimestamp < timestamp;
 }
 
+TClusterSlices SliceByCategory(const TClusters& clusters) {
+    TClusterSlices slices(tg::ECategory_ARRAYSIZE);
+    for (size_t i = 0; i < clusters.size(); ++i) {
+        const TNewsCluster& cluster = clusters[i];
+        for (const tg::ECategory category : {tg::NC_ANY, cluster.GetCategory()}) {
+            TClusterSlice& slice = slices[static_cast<size_t>(category)];
+            slice.Indices.push_back(static_cast<uint32_t>(i));
+            slice.FreshestTimestamps.push_back(cluster.GetFreshestTimestamp());
+            slice.BestTimestamps.push_back(cluster.GetBestTimestamp());
+            slice.Importances.push_back(cluster.GetImportance());
+            slice.Sizes.push_back(static_cast<uint32_t>(cluster.GetSize()));
+        }
+    }
+    return slices;
+}
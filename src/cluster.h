@@ -3,6 +3,8 @@
 #include "db_document.h"
 #include "agency_rating.h"
 
+#include <functional>
+
 class TAgencyRating;
 class TAlexaAgencyRating;
 
@@ -14,6 +16,9 @@ struct TSliceFeatures {
     std::map<std::string, double> WeightedCountryShare;
 };
 
+// Clusters do not own documents, they refer to the document store of TClusterIndex
+using TDbDocumentRef = std::reference_wrapper<const TDbDocument>;
+using TDbDocumentRefs = std::vector<TDbDocumentRef>;
 
 class TNewsCluster {
 private:
@@ -28,7 +33,10 @@ private:
     std::map<std::string, double> CountryShare;
     std::map<std::string, double> WeightedCountryShare;
 
-    std::vector<TDbDocument> Documents;
+    TDbDocumentRefs Documents;
+
+    // Compact JSON array of the cleaned file names, in the final order of documents
+    std::string ArticlesJson;
 
 public:
     explicit TNewsCluster(uint64_t id) : Id(id) {};
@@ -38,11 +46,11 @@ public:
 
     void CalcFeatures(
         const TAlexaAgencyRating& alexaRating,
-        const std::vector<TDbDocument>& docs);
+        const TDbDocumentRefs& docs);
 
     TSliceFeatures CalcImportance(
         const TAlexaAgencyRating& alexaRating,
-        const std::vector<TDbDocument>& docs,
+        const TDbDocumentRefs& docs,
         tg::ELanguage language,
         ERatingType type,
         double shift,
@@ -50,6 +58,7 @@ public:
 
     void CalcImportance(const TAlexaAgencyRating& alexaRating);
     void CalcCategory();
+    void SerializeArticles();
 
     bool operator<(const TNewsCluster& other) const;
     static bool Compare(const TNewsCluster& cluster, uint64_t timestamp);
@@ -59,17 +68,33 @@ public:
     tg::ECategory GetCategory() const { return Category; }
     uint64_t GetFreshestTimestamp() const { return FreshestTimestamp; }
     size_t GetSize() const { return Documents.size(); }
-    const std::vector<TDbDocument>& GetDocuments() const { return Documents; }
-    std::string GetTitle() const { return Documents.front().Title; }
-    tg::ELanguage GetLanguage() const { return Documents.front().Language; }
+    const TDbDocumentRefs& GetDocuments() const { return Documents; }
+    const std::string& GetTitle() const { return Documents.front().get().Title; }
+    tg::ELanguage GetLanguage() const { return Documents.front().get().Language; }
     double GetImportance() const { return Importance; }
     uint64_t GetBestTimestamp() const { return BestTimestamp; }
     const std::vector<double>& GetDocWeights() const { return DocWeights; }
     const std::vector<double>& GetFeatures() const { return Features; }
     const std::map<std::string, double>& GetCountryShare() const { return CountryShare; }
     const std::map<std::string, double>& GetWeightedCountryShare() const { return WeightedCountryShare; }
+    const std::string& GetArticlesJson() const { return ArticlesJson; }
 private:
     void SortByWeights(const std::vector<double>& weights);
 };
 
 using TClusters = std::vector<TNewsCluster>;
+
+// Clusters of one category as positions in the language clusters, in the same order.
+// Components of the cluster weight that do not depend on the request are stored along.
+struct TClusterSlice {
+    std::vector<uint32_t> Indices;
+    std::vector<uint64_t> FreshestTimestamps;
+    std::vector<uint64_t> BestTimestamps;
+    std::vector<double> Importances;
+    std::vector<uint32_t> Sizes;
+};
+
+// Slices indexed by category, the NC_ANY slice contains all clusters
+using TClusterSlices = std::vector<TClusterSlice>;
+
+TClusterSlices SliceByCategory(const TClusters& clusters);
@@ -1,5 +1,8 @@
 #include "clusterer.h"
 #include "clustering/slink.h"
+#include "metrics.h"
+#include "thread_pool.h"
+#include "trace.h"
 #include "util.h"
 
 #include <iostream>
@@ -26,7 +29,8 @@ TClusterer::TClusterer(const std::string& configPath) {
     }
 }
 
-TClusterIndex TClusterer::Cluster(std::vector<TDbDocument>&& docs) const {
+TClusterIndex TClusterer::Cluster(std::vector<TDbDocument>&& docs, const TSummarizer* summarizer) const {
+    TTraceSpan span("cluster_index");
     std::stable_sort(docs.begin(), docs.end(),
         [](const TDbDocument& d1, const TDbDocument& d2) {
             if (d1.FetchTime == d2.FetchTime) {
@@ -42,26 +46,58 @@ TClusterIndex TClusterer::Cluster(std::vector<TDbDocument>&& docs) const {
     clusterIndex.IterTimestamp = GetIterTimestamp(docs, Config.iter_timestamp_percentile());
     clusterIndex.TrueMaxTimestamp = docs.empty() ? 0 : docs.back().FetchTime;
 
-    std::map<tg::ELanguage, std::vector<TDbDocument>> lang2Docs;
+    std::unordered_map<tg::ELanguage, size_t> languageSizes;
+    for (const TDbDocument& doc : docs) {
+        ++languageSizes[doc.Language];
+    }
+    for (const auto& [language, _] : Clusterings) {
+        clusterIndex.Documents[language].reserve(languageSizes[language]);
+    }
     while (!docs.empty()) {
-        const TDbDocument& doc = docs.back();
-        if (Clusterings.find(doc.Language) != Clusterings.end()) {
-            lang2Docs[doc.Language].push_back(doc);
+        TDbDocument& doc = docs.back();
+        auto it = clusterIndex.Documents.find(doc.Language);
+        if (it != clusterIndex.Documents.end()) {
+            it->second.push_back(std::move(doc));
         }
         docs.pop_back();
     }
     docs.shrink_to_fit();
-    docs.clear();
+
+    TThreadPool& threadPool = TThreadPool::GetShared();
+    std::vector<std::pair<tg::ELanguage, std::future<std::pair<TClusters, TClusterSlices>>>> futures;
+    futures.reserve(Clusterings.size());
     for (const auto& [language, clustering] : Clusterings) {
-        TClusters langClusters = clustering->Cluster(lang2Docs[language]);
-        std::stable_sort(
-            langClusters.begin(),
-            langClusters.end(),
-            [](const TNewsCluster& a, const TNewsCluster& b) {
-                return a.GetFreshestTimestamp() < b.GetFreshestTimestamp();
+        const std::vector<TDbDocument>& langDocs = clusterIndex.Documents.at(language);
+        // A language always runs on the same node, where its SLINK buffers were first touched
+        const size_t node = static_cast<size_t>(language);
+        futures.emplace_back(language, threadPool.EnqueueOnNode(node, [&clustering = clustering, &langDocs, summarizer]() {
+            TTimer<std::chrono::steady_clock, std::chrono::microseconds> timer;
+            TClusters langClusters = clustering->Cluster(langDocs);
+            std::stable_sort(
+                langClusters.begin(),
+                langClusters.end(),
+                [](const TNewsCluster& a, const TNewsCluster& b) {
+                    return a.GetFreshestTimestamp() < b.GetFreshestTimestamp();
+                }
+            );
+            GetIndexStageHistogram("cluster").Record(timer.Elapsed());
+            TClusterSlices langSlices;
+            if (summarizer) {
+                timer.Reset();
+                summarizer->Summarize(langClusters);
+                TTraceSpan sliceSpan("slice_by_category");
+                langSlices = SliceByCategory(langClusters);
+                GetIndexStageHistogram("summarize").Record(timer.Elapsed());
             }
-        );
+            return std::make_pair(std::move(langClusters), std::move(langSlices));
+        }));
+    }
+    for (auto& [language, futureClusters] : futures) {
+        auto [langClusters, langSlices] = threadPool.Wait(futureClusters);
         clusterIndex.Clusters[language] = std::move(langClusters);
+        if (!langSlices.empty()) {
+            clusterIndex.Slices[language] = std::move(langSlices);
+        }
     }
     return clusterIndex;
 }
@@ -5,21 +5,46 @@
 #include "clustering/clustering.h"
 #include "config.pb.h"
 #include "db_document.h"
+#include "summarizer.h"
+#include "threads_cache.h"
 
 #include <vector>
 #include <memory>
 
+struct TIndexStats {
+    // Number of the index since the server start
+    uint64_t Generation = 0;
+    // Reading documents, clustering and summarization
+    uint64_t BuildTimeMs = 0;
+    // Moving the documents out of the previous index and freeing the rest of it. This is not the
+    // allocator time of the build, which is not measured
+    uint64_t ReleaseTimeMs = 0;
+    // Peak resident set size of the process during the build
+    uint64_t PeakRssKb = 0;
+    // Database snapshot the index is built from and the number of stale documents deleted after it
+    uint64_t DbSequenceNumber = 0;
+    uint64_t RemovedDocs = 0;
+};
+
 struct TClusterIndex {
+    // Immutable document store, clusters refer to its elements
+    std::unordered_map<tg::ELanguage, std::vector<TDbDocument>> Documents;
     std::unordered_map<tg::ELanguage, TClusters> Clusters;
+    // Per category slices of summarized clusters
+    std::unordered_map<tg::ELanguage, TClusterSlices> Slices;
     uint64_t IterTimestamp = 0;
     uint64_t TrueMaxTimestamp = 0;
+    // Responses of the server are valid until the index is replaced, so they live here
+    std::unique_ptr<TThreadsCache> ThreadsCache;
+    TIndexStats Stats;
 };
 
 class TClusterer {
 public:
     TClusterer(const std::string& configPath);
 
-    TClusterIndex Cluster(std::vector<TDbDocument>&& docs) const;
+    // Languages are processed concurrently; clusters are summarized when summarizer is set
+    TClusterIndex Cluster(std::vector<TDbDocument>&& docs, const TSummarizer* summarizer = nullptr) const;
 
 private:
     void Summarize(TClusters& clusters) const;
@@ -7,6 +7,8 @@ class TClustering {
 public:
     TClustering() = default;
     virtual ~TClustering() = default;
+
+    // Output clusters refer to the elements of docs, so docs must outlive them
     virtual TClusters Cluster(
         const std::vector<TDbDocument>& docs
     ) = 0;
@@ -1,8 +1,13 @@
 #include "slink.h"
+#include "slink_stages.h"
+#include "../thread_pool.h"
+#include "../trace.h"
 #include "../util.h"
 
 #include <algorithm>
+#include <array>
 #include <fstream>
+#include <future>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -15,10 +20,27 @@ using TClusterSiteNames = std::unordered_set<std::string>;
 
 constexpr float INF_DISTANCE = 1.0f;
 
+// Distances are calculated by square tiles: a tile and a product buffer for it fit in L2 together
+constexpr size_t DISTANCE_TILE_SIZE = 128;
+
+struct TNormalizedPoints {
+    Eigen::MatrixXf Points;
+    std::vector<size_t> BadPoints; // sorted
+    float Weight = 0.0f;
+};
+
+std::vector<std::pair<size_t, size_t>> SplitToTiles(size_t begin, size_t end) {
+    std::vector<std::pair<size_t, size_t>> tiles;
+    for (size_t tileBegin = begin; tileBegin < end; tileBegin += DISTANCE_TILE_SIZE) {
+        tiles.emplace_back(tileBegin, std::min(end - tileBegin, DISTANCE_TILE_SIZE));
+    }
+    return tiles;
+}
+
 void ApplyTimePenalty(
     const std::vector<TDbDocument>::const_iterator begin,
     size_t docSize,
-    Eigen::MatrixXf& distances
+    Eigen::Ref<Eigen::MatrixXf> distances
 ) {
     std::vector<TDbDocument>::const_iterator iIt = begin;
     std::vector<TDbDocument>::const_iterator jIt = begin + 1;
@@ -67,60 +89,132 @@ bool HasSameSource(const TClusterSiteNames& firstSet, const TClusterSiteNames& s
 
 TSlinkClustering::TSlinkClustering(const tg::TClusteringConfig& config)
     : Config(config)
+    , DistanceBuffersBytes(TMetricsRegistry::Get().GetGauge(
+        "newsbot_slink_distance_buffers_bytes",
+        "Distance matrices held by the clustering of the language, they are freed after every index build",
+        {{"language", ToString(config.language())}}))
 {
+    ENSURE(Config.intersection_size() < Config.chunk_size(), "Batches intersection should be smaller than a batch");
 }
 
 TClusters TSlinkClustering::Cluster(
     const std::vector<TDbDocument>& docs
 ) {
+    TTraceSpan span("slink_cluster");
     std::unordered_map<tg::EEmbeddingKey, float> embeddingKeysWeights;
     for (const auto& embeddingKeyWeight : Config.embedding_keys_weights()) {
         embeddingKeysWeights[embeddingKeyWeight.embedding_key()] = embeddingKeyWeight.weight();
     }
     const size_t docSize = docs.size();
+    if (docSize == 0) {
+        return {};
+    }
 
+    // Batch boundaries do not depend on linking results, so they are known beforehand
     const size_t intersectionSize = Config.intersection_size();
+    std::vector<std::pair<size_t, size_t>> batches;
+    for (size_t batchStart = 0;;) {
+        const size_t batchSize = std::min(docSize - batchStart, static_cast<size_t>(Config.chunk_size()));
+        batches.emplace_back(batchStart, batchSize);
+        if (batchStart + batchSize >= docSize) {
+            break;
+        }
+        batchStart = batchStart + batchSize - intersectionSize;
+    }
+
+    // Two-stage pipeline: distances of the next batch are computed while the current one is linked.
+    // Both stages work on two matrices that are reused by all the batches of this call. They are
+    // freed on return, as an idle server would otherwise hold up to 2 * chunk_size^2 floats per language.
+    // The buffers are zeroed here by the thread of the language, so with a NUMA-aware executor
+    // their pages are placed on its node, and the stages below run on the same node.
+    // The second matrix is needed only if there is more than one batch.
+    const size_t maxBatchSize = batches.front().second;
+    std::array<std::vector<float>, 2> distanceBuffers;
+    Eigen::MatrixXf overlapDistances;
+    struct TBuffersGaugeReset {
+        TGauge& Gauge;
+        ~TBuffersGaugeReset() {
+            Gauge.Set(0.0);
+        }
+    } buffersGaugeReset{DistanceBuffersBytes};
+    for (size_t bufferIndex = 0; bufferIndex < distanceBuffers.size() && bufferIndex < batches.size(); ++bufferIndex) {
+        distanceBuffers[bufferIndex].resize(maxBatchSize * maxBatchSize);
+    }
+    DistanceBuffersBytes.Set((distanceBuffers[0].size() + distanceBuffers[1].size()) * sizeof(float));
+    const auto getBatchDistances = [&](size_t batchIndex) {
+        const size_t batchSize = batches[batchIndex].second;
+        return Eigen::Map<Eigen::MatrixXf>(distanceBuffers[batchIndex % 2].data(), batchSize, batchSize);
+    };
+    // Consecutive batches share intersectionSize documents, so the raw distances between them
+    // are carried to the next batch before the linking and the time penalty change them
+    const auto calcBatchDistances = [&](size_t batchIndex) {
+        const auto [batchStart, batchSize] = batches[batchIndex];
+        const auto begin = docs.cbegin() + batchStart;
+        Eigen::Map<Eigen::MatrixXf> distances = getBatchDistances(batchIndex);
+        const size_t knownSize = batchIndex != 0 ? intersectionSize : 0;
+        if (knownSize != 0) {
+            distances.topLeftCorner(knownSize, knownSize) = overlapDistances;
+        }
+        CalcSlinkDistances(begin, begin + batchSize, embeddingKeysWeights, knownSize, distances);
+        if (batchIndex + 1 < batches.size()) {
+            overlapDistances = distances.bottomRightCorner(intersectionSize, intersectionSize);
+        }
+        if (Config.use_timestamp_moving()) {
+            ApplyTimePenalty(begin, batchSize, distances);
+        }
+    };
+
     std::vector<size_t> labels;
     labels.reserve(docSize);
-
-    std::vector<TDbDocument>::const_iterator begin = docs.cbegin();
     std::unordered_map<size_t, size_t> oldLabelsToNew;
-    size_t batchStart = 0;
-    size_t prevBatchEnd = batchStart;
     size_t maxLabel = 0;
-    while (prevBatchEnd < docs.size()) {
-        size_t remainingDocsCount = docSize - batchStart;
-        size_t batchSize = std::min(remainingDocsCount, static_cast<size_t>(Config.chunk_size()));
-        std::vector<TDbDocument>::const_iterator end = begin + batchSize;
-
-        std::vector<size_t> newLabels = ClusterBatch(begin, end, embeddingKeysWeights);
-        std::for_each(newLabels.begin(), newLabels.end(), [&](size_t& i){ i += maxLabel; });
-        maxLabel = *std::max_element(newLabels.begin(), newLabels.end());
-
-        assert(begin->Url == docs[batchStart].Url);
-        for (size_t i = batchStart; i < batchStart + intersectionSize && i < labels.size(); i++) {
-            size_t oldLabel = labels[i];
-            size_t batchIndex = static_cast<size_t>(i - batchStart);
-            size_t newLabel = newLabels.at(batchIndex);
-            oldLabelsToNew[oldLabel] = newLabel;
+    TThreadPool& threadPool = TThreadPool::GetShared();
+    calcBatchDistances(0);
+    for (size_t batchIndex = 0; batchIndex < batches.size(); ++batchIndex) {
+        std::future<void> nextBatchDistances;
+        if (batchIndex + 1 < batches.size()) {
+            nextBatchDistances = threadPool.EnqueueOnNode(threadPool.GetCurrentNode(), calcBatchDistances, batchIndex + 1);
         }
-        if (batchStart == 0) {
-            for (size_t i = 0; i < std::min(intersectionSize, newLabels.size()); i++) {
+
+        try {
+            const auto [batchStart, batchSize] = batches[batchIndex];
+            const auto begin = docs.cbegin() + batchStart;
+            const auto end = begin + batchSize;
+            std::vector<size_t> newLabels = ClusterSlinkBatch(Config, begin, end, getBatchDistances(batchIndex));
+            std::for_each(newLabels.begin(), newLabels.end(), [&](size_t& i){ i += maxLabel; });
+            maxLabel = *std::max_element(newLabels.begin(), newLabels.end());
+
+            for (size_t i = batchStart; i < batchStart + intersectionSize && i < labels.size(); i++) {
+                size_t oldLabel = labels[i];
+                size_t batchOffset = static_cast<size_t>(i - batchStart);
+                size_t newLabel = newLabels.at(batchOffset);
+                oldLabelsToNew[oldLabel] = newLabel;
+            }
+            if (batchStart == 0) {
+                for (size_t i = 0; i < std::min(intersectionSize, newLabels.size()); i++) {
+                    labels.push_back(newLabels[i]);
+                }
+            }
+            for (size_t i = intersectionSize; i < newLabels.size(); i++) {
                 labels.push_back(newLabels[i]);
             }
-        }
-        for (size_t i = intersectionSize; i < newLabels.size(); i++) {
-            labels.push_back(newLabels[i]);
-        }
-        assert(batchStart == static_cast<size_t>(std::distance(docs.begin(), begin)));
-        assert(batchStart + batchSize == static_cast<size_t>(std::distance(docs.begin(), end)));
-        for (const auto& pair : oldLabelsToNew) {
-            assert(pair.first < pair.second);
+            for (const auto& pair : oldLabelsToNew) {
+                assert(pair.first < pair.second);
+            }
+        } catch (...) {
+            // The pending task writes the buffers and reads the locals of this frame
+            if (nextBatchDistances.valid()) {
+                try {
+                    threadPool.Wait(nextBatchDistances);
+                } catch (...) {
+                }
+            }
+            throw;
         }
 
-        prevBatchEnd = batchStart + batchSize;
-        batchStart = prevBatchEnd - intersectionSize;
-        begin = end - intersectionSize;
+        if (nextBatchDistances.valid()) {
+            threadPool.Wait(nextBatchDistances);
+        }
     }
     assert(labels.size() == docs.size());
     for (auto& label : labels) {
@@ -149,19 +243,16 @@ TClusters TSlinkClustering::Cluster(
 }
 
 // SLINK: https://sites.cs.ucsb.edu/~veronika/MAE/summary_SLINK_Sibson72.pdf
-std::vector<size_t> TSlinkClustering::ClusterBatch(
+std::vector<size_t> ClusterSlinkBatch(
+    const tg::TClusteringConfig& config,
     const std::vector<TDbDocument>::const_iterator begin,
     const std::vector<TDbDocument>::const_iterator end,
-    const std::unordered_map<tg::EEmbeddingKey, float>& embeddingKeysWeights
+    Eigen::Ref<Eigen::MatrixXf> distances
 ) {
+    TTraceSpan span("slink_batch");
     const size_t docSize = std::distance(begin, end);
     assert(docSize != 0);
-
-    Eigen::MatrixXf distances = CalcDistances(begin, end, embeddingKeysWeights);
-
-    if (Config.use_timestamp_moving()) {
-        ApplyTimePenalty(begin, docSize, distances);
-    }
+    assert(static_cast<size_t>(distances.rows()) == docSize);
 
     // Prepare 3 arrays
     std::vector<size_t> labels(docSize);
@@ -182,12 +273,12 @@ std::vector<size_t> TSlinkClustering::ClusterBatch(
     auto it = begin;
     for (size_t i = 0; i < docSize; i++) {
         clusterSizes[i] = 1;
-        if (Config.ban_same_hosts()) {
+        if (config.ban_same_hosts()) {
             clusterSiteNames[i].insert(it->SiteName);
             ++it;
         }
     }
-    assert(!Config.ban_same_hosts() || it == end);
+    assert(!config.ban_same_hosts() || it == end);
 
     // Main linking loop
     float prevStepMinDistance = 0.0f;
@@ -199,15 +290,15 @@ std::vector<size_t> TSlinkClustering::ClusterBatch(
         const float minDistance = *minDistanceIt;
         ENSURE(prevStepMinDistance <= minDistance, "SLINK non-decreasing distance invariant failed");
         prevStepMinDistance = minDistance;
-        if (minDistance > Config.small_threshold()) {
+        if (minDistance > config.small_threshold()) {
             break;
         }
 
         const size_t firstClusterSize = clusterSizes[minI];
         const size_t secondClusterSize = clusterSizes[minJ];
         const size_t newClusterSize = firstClusterSize + secondClusterSize;
-        const bool isAcceptableSize = IsNewClusterSizeAcceptable(newClusterSize, minDistance, Config);
-        const bool hasSameSource = Config.ban_same_hosts() && HasSameSource(clusterSiteNames[minI], clusterSiteNames[minJ]);
+        const bool isAcceptableSize = IsNewClusterSizeAcceptable(newClusterSize, minDistance, config);
+        const bool hasSameSource = config.ban_same_hosts() && HasSameSource(clusterSiteNames[minI], clusterSiteNames[minJ]);
         if (!isAcceptableSize || hasSameSource) {
             nnDistances[minI] = INF_DISTANCE;
             nnDistances[minJ] = INF_DISTANCE;
@@ -240,7 +331,7 @@ std::vector<size_t> TSlinkClustering::ClusterBatch(
 
         clusterSizes[minI] = newClusterSize;
         clusterSizes[minJ] = newClusterSize;
-        if (Config.ban_same_hosts()) {
+        if (config.ban_same_hosts()) {
             clusterSiteNames[minI].insert(clusterSiteNames[minJ].begin(), clusterSiteNames[minJ].end());
         }
 
@@ -274,45 +365,84 @@ std::vector<size_t> TSlinkClustering::ClusterBatch(
     return labels;
 }
 
-Eigen::MatrixXf TSlinkClustering::CalcDistances(
+void CalcSlinkDistances(
     const std::vector<TDbDocument>::const_iterator begin,
     const std::vector<TDbDocument>::const_iterator end,
-    const std::unordered_map<tg::EEmbeddingKey, float>& embeddingKeysWeights) const
+    const std::unordered_map<tg::EEmbeddingKey, float>& embeddingKeysWeights,
+    size_t knownSize,
+    Eigen::Ref<Eigen::MatrixXf> finalDistances)
 {
+    TTraceSpan span("calc_distances");
     const size_t docSize = std::distance(begin, end);
-    assert(docSize != 0);
+    assert(docSize != 0 && knownSize < docSize);
+    assert(static_cast<size_t>(finalDistances.rows()) == docSize);
 
-    Eigen::MatrixXf finalDistances = Eigen::MatrixXf::Zero(docSize, docSize);
+    std::vector<TNormalizedPoints> keysPoints;
+    keysPoints.reserve(embeddingKeysWeights.size());
     for (const auto& [embeddingKey, weight] : embeddingKeysWeights) {
         const size_t embSize = begin->Embeddings.at(embeddingKey).size();
-        Eigen::MatrixXf points(docSize, embSize);
-        std::vector<size_t> badPoints;
+        TNormalizedPoints& keyPoints = keysPoints.emplace_back();
+        keyPoints.Points.setZero(docSize, embSize);
+        keyPoints.Weight = weight;
         std::vector<TDbDocument>::const_iterator docsIt = begin;
-
         for (size_t i = 0; i < docSize; ++i) {
-            std::vector<float> embedding = docsIt->Embeddings.at(embeddingKey);
+            const std::vector<float>& embedding = docsIt->Embeddings.at(embeddingKey);
 
-            Eigen::Map<Eigen::VectorXf, Eigen::Unaligned> docVector(embedding.data(), embedding.size());
+            Eigen::Map<const Eigen::VectorXf, Eigen::Unaligned> docVector(embedding.data(), embedding.size());
             if (std::abs(docVector.norm() - 0.0) > 0.00000001) {
-                points.row(i) = docVector / docVector.norm();
+                keyPoints.Points.row(i) = docVector / docVector.norm();
             } else {
-                badPoints.push_back(i);
+                keyPoints.BadPoints.push_back(i);
             }
             docsIt++;
         }
+    }
 
-        // Assuming points are on unit sphere
-        // Normalize to [0.0, 1.0]
-        Eigen::MatrixXf distances(docSize, docSize);
-        distances = (-((points * points.transpose()).array() + 1.0f) / 2.0f + 1.0f) * weight;
-        distances += distances.Identity(docSize, docSize) * weight;
-        for (size_t index : badPoints) {
-            distances.row(index) = Eigen::VectorXf::Ones(docSize) * weight;
-            distances.col(index) = Eigen::VectorXf::Ones(docSize) * weight;
+    // Only rows of the new documents are calculated, their transposed copies become the new columns.
+    // Tiles below the diagonal are enough for the block of new documents, as it is symmetric.
+    const auto knownTiles = SplitToTiles(0, knownSize);
+    const auto newTiles = SplitToTiles(knownSize, docSize);
+    std::vector<std::pair<size_t, size_t>> tilePairs;
+    for (size_t i = 0; i < newTiles.size(); ++i) {
+        for (size_t j = 0; j < knownTiles.size() + i + 1; ++j) {
+            tilePairs.emplace_back(i, j);
         }
-        distances = distances.cwiseMax(0.0f);
-        finalDistances += distances;
     }
 
-    return finalDistances;
+    TThreadPool::GetShared().ParallelFor(0, tilePairs.size(), [&](size_t pairIndex) {
+        // Buffers of the tile are reused by all the tiles of the thread
+        thread_local Eigen::MatrixXf tile;
+        thread_local Eigen::MatrixXf product;
+        const auto [rowTileIndex, colTileIndex] = tilePairs[pairIndex];
+        const auto [rowBegin, rowSize] = newTiles[rowTileIndex];
+        const bool isKnownCol = colTileIndex < knownTiles.size();
+        const auto [colBegin, colSize] = isKnownCol ? knownTiles[colTileIndex] : newTiles[colTileIndex - knownTiles.size()];
+        const bool isDiagonal = rowBegin == colBegin;
+
+        // Weighted sum of all keys distances, accumulated in cache and written once
+        tile.setZero(rowSize, colSize);
+        for (const TNormalizedPoints& keyPoints : keysPoints) {
+            const float weight = keyPoints.Weight;
+            product.noalias() = keyPoints.Points.middleRows(rowBegin, rowSize) * keyPoints.Points.middleRows(colBegin, colSize).transpose();
+
+            // Assuming points are on unit sphere
+            // Normalize to [0.0, 1.0]
+            product = (-(product.array() + 1.0f) / 2.0f + 1.0f) * weight;
+            if (isDiagonal) {
+                product.diagonal().array() += weight;
+            }
+            const auto& badPoints = keyPoints.BadPoints;
+            for (auto it = std::lower_bound(badPoints.begin(), badPoints.end(), rowBegin); it != badPoints.end() && *it < rowBegin + rowSize; ++it) {
+                product.row(*it - rowBegin).setConstant(weight);
+            }
+            for (auto it = std::lower_bound(badPoints.begin(), badPoints.end(), colBegin); it != badPoints.end() && *it < colBegin + colSize; ++it) {
+                product.col(*it - colBegin).setConstant(weight);
+            }
+            tile += product.cwiseMax(0.0f);
+        }
+        finalDistances.block(rowBegin, colBegin, rowSize, colSize) = tile;
+        if (!isDiagonal) {
+            finalDistances.block(colBegin, rowBegin, colSize, rowSize) = tile.transpose();
+        }
+    }, 1);
 }
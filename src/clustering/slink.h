@@ -2,8 +2,9 @@
 
 #include "clustering.h"
 #include "config.pb.h"
+#include "../metrics.h"
 
-#include <Eigen/Core>
+#include <vector>
 
 class TSlinkClustering : public TClustering {
 public:
@@ -13,18 +14,8 @@ public:
         const std::vector<TDbDocument>& docs
     ) override;
 
-private:
-    Eigen::MatrixXf CalcDistances(
-        const std::vector<TDbDocument>::const_iterator begin,
-        const std::vector<TDbDocument>::const_iterator end,
-        const std::unordered_map<tg::EEmbeddingKey, float>& embeddingKeysWeights
-    ) const;
-    std::vector<size_t> ClusterBatch(
-        const std::vector<TDbDocument>::const_iterator begin,
-        const std::vector<TDbDocument>::const_iterator end,
-        const std::unordered_map<tg::EEmbeddingKey, float>& embeddingKeysWeights
-    );
-
 private:
     tg::TClusteringConfig Config;
+    // Bytes of the distance matrices, chunk_size^2 floats each, held while Cluster runs
+    TGauge& DistanceBuffersBytes;
 };
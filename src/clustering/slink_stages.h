@@ -0,0 +1,29 @@
+#pragma once
+
+#include "config.pb.h"
+#include "../db_document.h"
+
+#include <Eigen/Core>
+
+#include <unordered_map>
+#include <vector>
+
+// Stages of TSlinkClustering for a single batch. They are not a part of the clustering interface and
+// are declared separately for the benchmarks, which measure them one by one.
+
+// Top left knownSize x knownSize block of distances is expected to be filled already
+void CalcSlinkDistances(
+    const std::vector<TDbDocument>::const_iterator begin,
+    const std::vector<TDbDocument>::const_iterator end,
+    const std::unordered_map<tg::EEmbeddingKey, float>& embeddingKeysWeights,
+    size_t knownSize,
+    Eigen::Ref<Eigen::MatrixXf> distances
+);
+
+// Links the batch, distances are used as a scratch buffer
+std::vector<size_t> ClusterSlinkBatch(
+    const tg::TClusteringConfig& config,
+    const std::vector<TDbDocument>::const_iterator begin,
+    const std::vector<TDbDocument>::const_iterator end,
+    Eigen::Ref<Eigen::MatrixXf> distances
+);
@@ -2,6 +2,9 @@
 
 #include "document.h"
 #include "document.pb.h"
+#include "json_writer.h"
+#include "metrics.h"
+#include "trace.h"
 #include "util.h"
 
 #include <optional>
@@ -33,6 +36,13 @@ namespace {
         return std::nullopt;
     }
 
+    std::optional<size_t> ParseLimit(const std::string& value) try {
+        const int limit = std::stoi(value);
+        return limit >= 0 ? std::make_optional<size_t>(limit) : std::nullopt;
+    } catch (const std::exception& e) {
+        return std::nullopt;
+    }
+
     std::optional<tg::ELanguage> ParseLang(const std::string& value) {
         const tg::ELanguage lang = FromString<tg::ELanguage>(value);
         return lang != tg::LN_UNDEFINED ? std::make_optional(lang) : std::nullopt;
@@ -43,27 +53,108 @@ namespace {
         return category != tg::NC_UNDEFINED ? std::make_optional(category) : std::nullopt;
     }
 
-    Json::Value ToJson(const TNewsCluster& cluster) {
-        Json::Value articles(Json::arrayValue);
-        for (const auto& document : cluster.GetDocuments()) {
-            articles.append(document.FileName);
+    constexpr size_t THREADS_LIMIT = 1000;
+    constexpr size_t TRACE_SPANS_LIMIT = 1000;
+
+    const std::string& CategoryName(tg::ECategory category) {
+        static const std::vector<std::string> names = [] {
+            std::vector<std::string> names;
+            for (int i = 0; i < tg::ECategory_ARRAYSIZE; ++i) {
+                names.push_back(tg::ECategory_IsValid(i) && i != tg::NC_UNDEFINED ? ToString(static_cast<tg::ECategory>(i)) : "");
+            }
+            return names;
+        }();
+        return names[static_cast<size_t>(category)];
+    }
+
+    // Keys are written in the sorted order, as jsoncpp did before
+    std::string SerializeThreads(const std::vector<TWeightedNewsCluster>& weightedClusters) {
+        TTraceSpan span("serialize_threads");
+        size_t size = 16;
+        for (const auto& weightedCluster : weightedClusters) {
+            const TNewsCluster& cluster = weightedCluster.Cluster.get();
+            size += cluster.GetArticlesJson().size() + cluster.GetTitle().size() + 64;
+        }
+        std::string response;
+        response.reserve(size);
+
+        TJsonWriter writer(response);
+        writer.BeginObject().Key("threads").BeginArray();
+        for (const auto& weightedCluster : weightedClusters) {
+            const TNewsCluster& cluster = weightedCluster.Cluster.get();
+            writer.BeginObject()
+                .Key("articles").Raw(cluster.GetArticlesJson())
+                .Key("category").String(CategoryName(cluster.GetCategory()))
+                .Key("title").String(cluster.GetTitle())
+                .EndObject();
         }
+        writer.EndArray().EndObject();
+        return response;
+    }
+
+    void MakeJsonResponse(
+        std::function<void(const drogon::HttpResponsePtr&)>&& callback,
+        const std::string& body
+    ) {
+        auto resp = drogon::HttpResponse::newHttpResponse();
+        resp->setContentTypeCode(drogon::CT_APPLICATION_JSON);
+        resp->setBody(body);
+        callback(resp);
+    }
+
+    struct TControllerMetrics {
+        THistogram& PutLatency;
+        THistogram& PostLatency;
+        THistogram& DeleteLatency;
+        THistogram& ThreadsLatency;
+        THistogram& DbPutLatency;
+        THistogram& DbDeleteLatency;
+        THistogram& DbGetLatency;
+        THistogram& DbKeyMayExistLatency;
+        TCounter& ThreadsCacheHits;
+        TCounter& ThreadsCacheMisses;
+    };
+
+    THistogram& GetRequestHistogram(const std::string& handler) {
+        return TMetricsRegistry::Get().GetHistogram(
+            "newsbot_request_duration_seconds",
+            "Time spent in the request handlers",
+            {{"handler", handler}});
+    }
 
-        Json::Value json(Json::objectValue);
-        json["title"] = cluster.GetTitle();
-        json["category"] = ToString(cluster.GetCategory());
-        json["articles"] = std::move(articles);
-        return json;
+    THistogram& GetDbHistogram(const std::string& operation) {
+        return TMetricsRegistry::Get().GetHistogram(
+            "newsbot_rocksdb_operation_duration_seconds",
+            "Time spent in the RocksDB operations of the request handlers",
+            {{"operation", operation}});
+    }
+
+    const TControllerMetrics& GetControllerMetrics() {
+        static const TControllerMetrics metrics = {
+            GetRequestHistogram("put"),
+            GetRequestHistogram("post"),
+            GetRequestHistogram("delete"),
+            GetRequestHistogram("threads"),
+            GetDbHistogram("put"),
+            GetDbHistogram("delete"),
+            GetDbHistogram("get"),
+            GetDbHistogram("key_may_exist"),
+            TMetricsRegistry::Get().GetCounter("newsbot_threads_cache_hits_total", "Threads responses served from the cache"),
+            TMetricsRegistry::Get().GetCounter("newsbot_threads_cache_misses_total", "Threads responses ranked on request")
+        };
+        return metrics;
     }
 }
 
 void TController::Init(
     const THotState<TClusterIndex>* index,
+    const TClusteringScheduler* scheduler,
     rocksdb::DB* db,
     std::unique_ptr<TAnnotator> annotator,
     std::unique_ptr<TRanker> ranker
 ) {
     Index = index;
+    Scheduler = scheduler;
     Db = db;
     Annotator = std::move(annotator);
     Ranker = std::move(ranker);
@@ -100,6 +191,8 @@ bool TController::IndexDbDoc(const TDbDocument& dbDoc, const std::string& fname)
     }
     // TODO: possible races while the same fname is provided to multiple queries
     // TODO: use "value_found" flag and check DB instead of only bloom filter
+    TTraceSpan span("db_put");
+    TScopedLatency latency(GetControllerMetrics().DbPutLatency);
     const rocksdb::Status status= Db->Put(rocksdb::WriteOptions(), fname, serializedDoc);
     if (!status.ok()) {
         return false;
@@ -112,6 +205,7 @@ drogon::HttpStatusCode TController::GetCode(
     drogon::HttpStatusCode createdCode,
     drogon::HttpStatusCode existedCode
 ) const {
+    TScopedLatency latency(GetControllerMetrics().DbKeyMayExistLatency);
     std::string value;
     const auto mayExist = Db->KeyMayExist(rocksdb::ReadOptions(), fname, &value);
     return mayExist ? existedCode : createdCode;
@@ -123,6 +217,8 @@ void TController::Put(
     std::function<void(const drogon::HttpResponsePtr&)>&& callback,
     const std::string& fname
 ) const {
+    TTraceSpan span("put");
+    TScopedLatency latency(GetControllerMetrics().PutLatency);
     if (IsNotReady(std::move(callback))) {
         return;
     }
@@ -160,6 +256,9 @@ void TController::Delete(
     const std::string& fname
 ) const {
     UNUSED(req);
+    const TControllerMetrics& metrics = GetControllerMetrics();
+    TTraceSpan span("delete");
+    TScopedLatency latency(metrics.DeleteLatency);
     if (IsNotReady(std::move(callback))) {
         return;
     }
@@ -167,8 +266,13 @@ void TController::Delete(
     // TODO: possible races while the same fname is provided to multiple queries
     // TODO: use "value_found" flag and check DB instead of only bloom filter
     std::string value;
-    const bool mayExist = Db->KeyMayExist(rocksdb::ReadOptions(), fname, &value);
+    bool mayExist = false;
+    {
+        TScopedLatency dbLatency(metrics.DbKeyMayExistLatency);
+        mayExist = Db->KeyMayExist(rocksdb::ReadOptions(), fname, &value);
+    }
     if (mayExist) {
+        TScopedLatency dbLatency(metrics.DbDeleteLatency);
         const rocksdb::Status s = Db->Delete(rocksdb::WriteOptions(), fname);
         if (!s.ok()) {
             MakeSimpleResponse(std::move(callback), drogon::k500InternalServerError);
@@ -183,6 +287,9 @@ void TController::Threads(
     const drogon::HttpRequestPtr& req,
     std::function<void(const drogon::HttpResponsePtr&)>&& callback
 ) const {
+    const TControllerMetrics& metrics = GetControllerMetrics();
+    TTraceSpan span("threads");
+    TScopedLatency latency(metrics.ThreadsLatency);
     if (IsNotReady(std::move(callback))) {
         return;
     }
@@ -196,32 +303,93 @@ void TController::Threads(
         return;
     }
 
-    const std::shared_ptr<TClusterIndex> index = Index->AtomicGet();
-
-    const auto& clusters = index->Clusters.at(lang.value()); // TODO: possible missing key
-    const uint64_t fromTimestamp = index->TrueMaxTimestamp > period.value() ? index->TrueMaxTimestamp - period.value() : 0;
+    const auto index = Index->AtomicGet();
 
-    const auto indexIt = std::lower_bound(clusters.cbegin(), clusters.cend(), fromTimestamp, TNewsCluster::Compare);
-    const auto weightedClusters = Ranker->Rank(indexIt, clusters.cend(), index->IterTimestamp, period.value());
-    const auto& categoryClusters = weightedClusters.at(category.value());
-
-    Json::Value threads(Json::arrayValue);
-    int limit = 1000;
-    for (const auto& weightedCluster : categoryClusters) {
-        if (limit <= 0) {
-            break;
+    TThreadsCache* cache = index->ThreadsCache.get();
+    const std::optional<uint64_t> cachedPeriod = cache ? cache->GetCachedPeriod(period.value()) : std::nullopt;
+    if (cachedPeriod) {
+        const std::string* response = cache->Get(lang.value(), category.value(), cachedPeriod.value());
+        if (response) {
+            metrics.ThreadsCacheHits.Add();
+            MakeJsonResponse(std::move(callback), *response);
+            return;
         }
-        const TNewsCluster& cluster = weightedCluster.Cluster.get();
-        threads.append(ToJson(cluster));
-        --limit;
     }
+    metrics.ThreadsCacheMisses.Add();
+    const uint64_t threadsPeriod = cachedPeriod.value_or(period.value());
+
+    std::vector<TWeightedNewsCluster> weightedClusters;
+    const auto slices = index->Slices.find(lang.value());
+    if (slices != index->Slices.end()) {
+        TTraceSpan rankSpan("rank_top");
+        const uint64_t fromTimestamp = index->TrueMaxTimestamp > threadsPeriod ? index->TrueMaxTimestamp - threadsPeriod : 0;
+        weightedClusters = Ranker->RankTop(
+            index->Clusters.at(lang.value()),
+            slices->second.at(category.value()),
+            fromTimestamp,
+            index->IterTimestamp,
+            threadsPeriod,
+            THREADS_LIMIT);
+    }
+    std::string response = SerializeThreads(weightedClusters);
+    if (cachedPeriod) {
+        MakeJsonResponse(std::move(callback), *cache->Insert(lang.value(), category.value(), cachedPeriod.value(), std::move(response)));
+        return;
+    }
+    MakeJsonResponse(std::move(callback), response);
+}
 
-    Json::Value json(Json::objectValue);
-    json["threads"] = std::move(threads);
-    auto resp = drogon::HttpResponse::newHttpJsonResponse(json);
+void TController::IndexStatus(
+    const drogon::HttpRequestPtr& req,
+    std::function<void(const drogon::HttpResponsePtr&)>&& callback
+) const {
+    UNUSED(req);
+    if (IsNotReady(std::move(callback))) {
+        return;
+    }
+
+    const auto index = Index->AtomicGet();
+    const TIndexStats& stats = index->Stats;
+    std::string response;
+    TJsonWriter writer(response);
+    writer.BeginObject()
+        .Key("build_time_ms").Int(stats.BuildTimeMs)
+        .Key("generation").Int(stats.Generation)
+        .Key("peak_rss_kb").Int(stats.PeakRssKb)
+        .Key("pending_changes").Int(CountPendingChanges(Db, stats))
+        .Key("release_time_ms").Int(stats.ReleaseTimeMs)
+        .Key("staleness_ms").Int(Scheduler->GetStalenessMs())
+        .EndObject();
+    MakeJsonResponse(std::move(callback), response);
+}
+
+// Works before the initialization too, so that the startup can be monitored
+void TController::Metrics(
+    const drogon::HttpRequestPtr& req,
+    std::function<void(const drogon::HttpResponsePtr&)>&& callback
+) const {
+    UNUSED(req);
+    auto resp = drogon::HttpResponse::newHttpResponse();
+    resp->setContentTypeCode(drogon::CT_TEXT_PLAIN);
+    resp->setBody(TMetricsRegistry::Get().Serialize());
     callback(resp);
 }
 
+// Read-only, tracing is switched by the server config. "limit" is the number of the latest spans
+// of every thread to return, so that the response stays small.
+void TController::Trace(
+    const drogon::HttpRequestPtr& req,
+    std::function<void(const drogon::HttpResponsePtr&)>&& callback
+) const {
+    const std::string& limitParameter = req->getParameter("limit");
+    const std::optional<size_t> limit = limitParameter.empty() ? TRACE_SPANS_LIMIT : ParseLimit(limitParameter);
+    if (!limit) {
+        MakeSimpleResponse(std::move(callback), drogon::k400BadRequest);
+        return;
+    }
+    MakeJsonResponse(std::move(callback), TTracer::Get().ExportJson(*limit));
+}
+
 void TController::Get(
     const drogon::HttpRequestPtr& req,
     std::function<void(const drogon::HttpResponsePtr&)>&& callback,
@@ -233,7 +401,11 @@ void TController::Get(
     }
 
     std::string serializedDoc;
-    const rocksdb::Status s = Db->Get(rocksdb::ReadOptions(), fname, &serializedDoc);
+    rocksdb::Status s;
+    {
+        TScopedLatency latency(GetControllerMetrics().DbGetLatency);
+        s = Db->Get(rocksdb::ReadOptions(), fname, &serializedDoc);
+    }
 
     Json::Value ret;
     ret["fname"] = fname;
@@ -260,6 +432,8 @@ void TController::Post(
     std::function<void(const drogon::HttpResponsePtr&)>&& callback,
     const std::string& fname
 ) const {
+    TTraceSpan span("post");
+    TScopedLatency latency(GetControllerMetrics().PostLatency);
     if (IsNotReady(std::move(callback))) {
         return;
     }
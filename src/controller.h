@@ -4,6 +4,7 @@
 #include "clusterer.h"
 #include "hot_state.h"
 #include "ranker.h"
+#include "server_clustering.h"
 
 #include <drogon/HttpController.h>
 #include <rocksdb/db.h>
@@ -12,6 +13,9 @@ class TController : public drogon::HttpController<TController, /* AutoCreation *
 public:
     METHOD_LIST_BEGIN
         ADD_METHOD_TO(TController::Threads,"/threads", drogon::Get);
+        ADD_METHOD_TO(TController::IndexStatus,"/index_status", drogon::Get);
+        ADD_METHOD_TO(TController::Metrics,"/metrics", drogon::Get);
+        ADD_METHOD_TO(TController::Trace,"/trace", drogon::Get); // debug only
         ADD_METHOD_TO(TController::Put,"/{fname}", drogon::Put);
         ADD_METHOD_TO(TController::Delete,"/{fname}", drogon::Delete);
         ADD_METHOD_TO(TController::Post,"/{fname}", drogon::Post);
@@ -20,6 +24,7 @@ public:
 
     void Init(
         const THotState<TClusterIndex>* index,
+        const TClusteringScheduler* scheduler,
         rocksdb::DB* db,
         std::unique_ptr<TAnnotator> annotator,
         std::unique_ptr<TRanker> ranker
@@ -39,6 +44,18 @@ public:
         const drogon::HttpRequestPtr& req,
         std::function<void(const drogon::HttpResponsePtr&)>&& callback
     ) const;
+    void IndexStatus(
+        const drogon::HttpRequestPtr& req,
+        std::function<void(const drogon::HttpResponsePtr&)>&& callback
+    ) const;
+    void Metrics(
+        const drogon::HttpRequestPtr& req,
+        std::function<void(const drogon::HttpResponsePtr&)>&& callback
+    ) const;
+    void Trace(
+        const drogon::HttpRequestPtr& req,
+        std::function<void(const drogon::HttpResponsePtr&)>&& callback
+    ) const;
     void Get(
         const drogon::HttpRequestPtr& req,
         std::function<void(const drogon::HttpResponsePtr&)>&& callback,
@@ -70,6 +87,7 @@ private:
     std::atomic<bool> Initialized {false};
 
     const THotState<TClusterIndex>* Index;
+    const TClusteringScheduler* Scheduler;
 
     rocksdb::DB* Db;
     std::unique_ptr<TAnnotator> Annotator;
@@ -3,48 +3,66 @@
 
 TDbDocument TDbDocument::FromProto(const tg::TDocumentProto& proto) {
     TDbDocument document;
-    document.FileName = proto.file_name();
-    document.Url = proto.url();
-    document.Host = GetHost(document.Url);
-    document.SiteName = proto.site_name();
-    document.PubTime = proto.pub_time();
-    document.FetchTime = proto.fetch_time();
-    document.Ttl = proto.ttl();
-    document.Title = proto.title();
-    document.Text = proto.text();
-    document.Description = proto.text();
-    document.Language = proto.language();
-    document.Category = proto.category();
-    document.Nasty = proto.nasty();
+    FromProto(proto, &document);
+    return document;
+}
 
-    for (const auto& link : proto.out_links()) {
-        document.OutLinks.push_back(link);
-    }
+void TDbDocument::FromProto(const tg::TDocumentProto& proto, TDbDocument* document) {
+    document->FileName = proto.file_name();
+    document->Url = proto.url();
+    document->Host = GetHost(document->Url);
+    document->SiteName = proto.site_name();
+    document->PubTime = proto.pub_time();
+    document->FetchTime = proto.fetch_time();
+    document->Ttl = proto.ttl();
+    document->Title = proto.title();
+    document->Text = proto.text();
+    document->Description = proto.text();
+    document->Language = proto.language();
+    document->Category = proto.category();
+    document->Nasty = proto.nasty();
 
+    document->OutLinks.assign(proto.out_links().cbegin(), proto.out_links().cend());
+
+    // Vectors of the keys that are already present are overwritten, so their buffers are reused
+    static_assert(tg::EEmbeddingKey_ARRAYSIZE <= 64, "Embedding keys should fit in a mask");
+    uint64_t seenKeys = 0;
     for (const auto& embedding : proto.embeddings()) {
-        const auto& valueProto = embedding.value();
-        TEmbedding value(valueProto.cbegin(), valueProto.cend());
+        // Records of other builds may have keys unknown here, they do not fit in the mask
+        if (!tg::EEmbeddingKey_IsValid(embedding.key())) {
+            LOG_DEBUG("Skipping unknown embedding key " << static_cast<int>(embedding.key()) << " of " << proto.url());
+            continue;
+        }
+        const uint64_t keyBit = 1ull << static_cast<size_t>(embedding.key());
+        ENSURE(!(seenKeys & keyBit), "Unexpected key duplicate");
+        seenKeys |= keyBit;
 
-        const auto [_, success] = document.Embeddings.try_emplace(embedding.key(), std::move(value));
-        ENSURE(success, "Unexpected key duplicate");
+        const auto& valueProto = embedding.value();
+        document->Embeddings[embedding.key()].assign(valueProto.cbegin(), valueProto.cend());
+    }
+    for (auto it = document->Embeddings.begin(); it != document->Embeddings.end();) {
+        if (seenKeys & (1ull << static_cast<size_t>(it->first))) {
+            ++it;
+        } else {
+            it = document->Embeddings.erase(it);
+        }
     }
-
-    return document;
 }
 
 bool TDbDocument::FromProtoString(const std::string& value, TDbDocument* document) {
     tg::TDocumentProto proto;
     if (proto.ParseFromString(value)) {
-        *document = FromProto(proto);
+        FromProto(proto, document);
         return true;
     }
     return false;
 }
 
 bool TDbDocument::ParseFromArray(const void* data, int size, TDbDocument* document) {
-    tg::TDocumentProto proto;
+    // The message keeps its buffers between the calls
+    thread_local tg::TDocumentProto proto;
     if (proto.ParseFromArray(data, size)) {
-        *document = FromProto(proto);
+        FromProto(proto, document);
         return true;
     }
     return false;
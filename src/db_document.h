@@ -34,7 +34,17 @@ public:
     bool Nasty = false;
 
 public:
+    TDbDocument() = default;
+    TDbDocument(TDbDocument&&) = default;
+    TDbDocument& operator=(TDbDocument&&) = default;
+
+    // Documents carry texts, embeddings and links, so they are moved, never copied
+    TDbDocument(const TDbDocument&) = delete;
+    TDbDocument& operator=(const TDbDocument&) = delete;
+
     static TDbDocument FromProto(const tg::TDocumentProto& proto);
+    // Overwrites the document in place, reusing its buffers
+    static void FromProto(const tg::TDocumentProto& proto, TDbDocument* document);
     static bool FromProtoString(const std::string& value, TDbDocument* document);
     static bool ParseFromArray(const void* data, int size, TDbDocument* document);
 
@@ -1,29 +1,96 @@
 #include "detect.h"
 #include "document.h"
+#include "tokenized_document.h"
 #include "util.h"
 
-#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <initializer_list>
+#include <istream>
 #include <optional>
-#include <sstream>
+#include <streambuf>
 
 #include <fasttext.h>
 
+namespace {
+    // Reads the segments as one line separated by spaces, with the newlines read as spaces, as
+    // fastText classifies a single line. The get area points into the segments, nothing is copied.
+    class TLineStreamBuf : public std::streambuf {
+    public:
+        TLineStreamBuf(const std::string_view* segmentsBegin, const std::string_view* segmentsEnd)
+            : Segment(segmentsBegin)
+            , SegmentsEnd(segmentsEnd)
+        {
+        }
+
+    protected:
+        int_type underflow() override {
+            while (Segment != SegmentsEnd) {
+                const std::string_view rest = Segment->substr(Position);
+                if (!rest.empty()) {
+                    if (rest.front() == '\n') {
+                        Position += 1;
+                        return SetSpace();
+                    }
+                    const void* newline = std::memchr(rest.data(), '\n', rest.size());
+                    const size_t length = newline ? static_cast<const char*>(newline) - rest.data() : rest.size();
+                    char* begin = const_cast<char*>(rest.data());
+                    setg(begin, begin, begin + length);
+                    Position += length;
+                    return traits_type::to_int_type(*begin);
+                }
+                ++Segment;
+                Position = 0;
+                if (Segment != SegmentsEnd) {
+                    return SetSpace();
+                }
+            }
+            return traits_type::eof();
+        }
+
+    private:
+        int_type SetSpace() {
+            setg(&Space, &Space, &Space + 1);
+            return traits_type::to_int_type(Space);
+        }
+
+    private:
+        const std::string_view* Segment;
+        const std::string_view* SegmentsEnd;
+        size_t Position = 0;
+        char Space = ' ';
+    };
+
+    // Reused by the calls of a thread, so that a prediction allocates nothing of its own
+    struct TPredictionBuffers {
+        std::vector<int32_t> Words;
+        std::vector<int32_t> Labels;
+        fasttext::Predictions Predictions;
+    };
+}
+
+// Same as predictLine on the segments joined by spaces with the newlines replaced, without building the line
 std::optional<std::pair<std::string, double>> RunFasttextClf(
     const fasttext::FastText& model,
-    const std::string& originalText,
+    std::initializer_list<std::string_view> segments,
     double border)
 {
-    std::string text = originalText;
-    std::replace(text.begin(), text.end(), '\n', ' ');
-    std::istringstream ifs(text);
-    std::vector<std::pair<fasttext::real, std::string>> predictions;
-    model.predictLine(ifs, predictions, 1, border);
-    if (predictions.empty()) {
+    TLineStreamBuf lineBuffer(segments.begin(), segments.end());
+    std::istream line(&lineBuffer);
+    if (line.peek() == EOF) {
+        return std::nullopt;
+    }
+    thread_local TPredictionBuffers buffers;
+    const std::shared_ptr<const fasttext::Dictionary> dictionary = model.getDictionary();
+    dictionary->getLine(line, buffers.Words, buffers.Labels);
+    buffers.Predictions.clear();
+    model.predict(1, buffers.Words, buffers.Predictions, border);
+    if (buffers.Predictions.empty()) {
         return std::nullopt;
     }
-    double probability = predictions[0].first;
+    double probability = std::exp(buffers.Predictions[0].first);
     const size_t FT_PREFIX_LENGTH = 9; // __label__
-    const std::string label = predictions[0].second.substr(FT_PREFIX_LENGTH);
+    const std::string label = dictionary->getLabel(buffers.Predictions[0].second).substr(FT_PREFIX_LENGTH);
     return std::make_pair(label, probability);
 }
 
@@ -67,8 +134,8 @@ bool TooManyUnknownSymbols(const TDocument& doc) {
 }
 
 tg::ELanguage DetectLanguage(const fasttext::FastText& model, const TDocument& document) {
-    std::string sample(document.Title + " " + document.Description + " " + document.Text.substr(0, 100));
-    auto pair = RunFasttextClf(model, sample, 0.4);
+    const std::string_view text = std::string_view(document.Text).substr(0, 100);
+    auto pair = RunFasttextClf(model, {document.Title, document.Description, text}, 0.4);
     if (!pair) {
         return tg::LN_UNDEFINED;
     }
@@ -86,8 +153,7 @@ tg::ELanguage DetectLanguage(const fasttext::FastText& model, const TDocument& d
     return tg::LN_OTHER;
 }
 
-tg::ECategory DetectCategory(const fasttext::FastText& model, const std::string& title, const std::string& text) {
-    std::string sample(title + " " + text);
-    auto pair = RunFasttextClf(model, sample, 0.0);
+tg::ECategory DetectCategory(const fasttext::FastText& model, const TTokenizedDocument& document) {
+    auto pair = RunFasttextClf(model, {document.Get(tg::EF_ALL)}, 0.0);
     return pair ? FromString<tg::ECategory>(pair->first) : tg::NC_UNDEFINED;
 }
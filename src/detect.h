@@ -7,6 +7,7 @@ namespace fasttext {
 }
 
 struct TDocument;
+class TTokenizedDocument;
 
 tg::ELanguage DetectLanguage(const fasttext::FastText& model, const TDocument& document);
-tg::ECategory DetectCategory(const fasttext::FastText& model, const std::string& title, const std::string& text);
+tg::ECategory DetectCategory(const fasttext::FastText& model, const TTokenizedDocument& document);
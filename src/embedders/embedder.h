@@ -2,6 +2,7 @@
 
 #include "config.pb.h"
 #include "enum.pb.h"
+#include "../tokenized_document.h"
 
 class TEmbedder {
 public:
@@ -11,16 +12,9 @@ public:
 
     virtual std::vector<float> CalcEmbedding(const std::string& input) const = 0;
 
-    std::vector<float> CalcEmbedding(const std::string& title, const std::string& text) const {
-        std::string input;
-        if (Field == tg::EF_ALL) {
-            input = title + " " + text;
-        } else if (Field == tg::EF_TITLE) {
-            input = title;
-        } else if (Field == tg::EF_TEXT) {
-            input = text;
-        }
-        return CalcEmbedding(input);
+    // Embedding of the field of the document, the embedders override it to take the words without splitting
+    virtual std::vector<float> CalcEmbedding(const TTokenizedDocument& document) const {
+        return CalcEmbedding(std::string(document.Get(Field)));
     }
 
 protected:
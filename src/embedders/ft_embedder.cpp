@@ -1,10 +1,15 @@
 #include "ft_embedder.h"
+#include "../trace.h"
 #include "../util.h"
 
-#include <sstream>
 #include <cassert>
 
-#include <onmt/Tokenizer.h>
+namespace {
+    // Same as std::isspace in the C locale, which splits words for operator>>
+    bool IsSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+    }
+}
 
 TFastTextEmbedder::TFastTextEmbedder(
     const std::string& vectorModelPath
@@ -12,6 +17,8 @@ TFastTextEmbedder::TFastTextEmbedder(
     , tg::EAggregationMode mode
     , size_t maxWords
     , const std::string& modelPath
+    , size_t cachedWordsCount
+    , const std::string& wordVectorsPath
 )
     : TEmbedder(field)
     , Mode(mode)
@@ -19,7 +26,11 @@ TFastTextEmbedder::TFastTextEmbedder(
 {
     assert(!vectorModelPath.empty());
     VectorModel.loadModel(vectorModelPath);
+    Dimension = VectorModel.getDimension();
     LOG_DEBUG("FastText " << vectorModelPath << " vector model loaded");
+    if (cachedWordsCount != 0) {
+        WordVectors = std::make_unique<TWordVectorsCache>(VectorModel, vectorModelPath, cachedWordsCount, wordVectorsPath);
+    }
 
     if (!modelPath.empty()) {
         Model = torch::jit::load(modelPath);
@@ -32,69 +43,119 @@ TFastTextEmbedder::TFastTextEmbedder(tg::TEmbedderConfig config) : TFastTextEmbe
     config.embedder_field(),
     config.aggregation_mode(),
     config.max_words() != 0 ? config.max_words() : 100,
-    config.model_path()
+    config.model_path(),
+    config.cached_words(),
+    config.word_vectors_path()
 ) {}
 
-std::vector<float> TFastTextEmbedder::CalcEmbedding(const std::string& input) const {
-    std::istringstream ss(input);
-    size_t vectorSize = VectorModel.getDimension();
-    fasttext::Vector wordVector(vectorSize);
-    fasttext::Vector avgVector(vectorSize);
-    fasttext::Vector maxVector(vectorSize);
-    fasttext::Vector minVector(vectorSize);
-    std::string word;
+template <class TNextWord>
+size_t TFastTextEmbedder::AggregateWordVectors(TNextWord&& nextWord, float* avgData, float* maxData, float* minData) const {
+    Eigen::Map<Eigen::ArrayXf> avg(avgData, Dimension);
+    Eigen::Map<Eigen::ArrayXf> max(maxData, Dimension);
+    Eigen::Map<Eigen::ArrayXf> min(minData, Dimension);
+    avg.setZero();
+    max.setZero();
+    min.setZero();
+
+    fasttext::Vector wordVector(Dimension);
     size_t count = 0;
-    while (ss >> word) {
-        if (count > MaxWords) {
-            break;
-        }
-        VectorModel.getWordVector(wordVector, word);
-        float norm = wordVector.norm();
-        if (norm < 0.0001f) {
-            continue;
+    std::string_view word;
+    while (count <= MaxWords && nextWord(word)) {
+        const float* vectorData = nullptr;
+        if (WordVectors && WordVectors->Find(word, vectorData)) {
+            if (!vectorData) {
+                continue;
+            }
+        } else {
+            VectorModel.getWordVector(wordVector, std::string(word));
+            const float norm = wordVector.norm();
+            if (norm < TWordVectorsCache::MIN_WORD_NORM) {
+                continue;
+            }
+            wordVector.mul(1.0f / norm);
+            vectorData = wordVector.data();
         }
-        wordVector.mul(1.0f / norm);
 
-        avgVector.addVector(wordVector);
+        // Eigen vectorizes each of these over the whole vector
+        const Eigen::Map<const Eigen::ArrayXf> vector(vectorData, Dimension);
+        avg += vector;
         if (count == 0) {
-            maxVector = wordVector;
-            minVector = wordVector;
+            max = vector;
+            min = vector;
         } else {
-            for (size_t i = 0; i < vectorSize; i++) {
-                maxVector[i] = std::max(maxVector[i], wordVector[i]);
-                minVector[i] = std::min(minVector[i], wordVector[i]);
-            }
+            max = max.max(vector);
+            min = min.min(vector);
         }
         count += 1;
     }
     if (count > 0) {
-        avgVector.mul(1.0f / static_cast<float>(count));
+        avg *= 1.0f / static_cast<float>(count);
     }
-    if (Mode == tg::AM_AVG) {
-        return std::vector<float>(avgVector.data(), avgVector.data() + avgVector.size());
-    } else if (Mode == tg::AM_MIN) {
-        return std::vector<float>(minVector.data(), minVector.data() + minVector.size());
-    } else if (Mode == tg::AM_MAX) {
-        return std::vector<float>(maxVector.data(), maxVector.data() + maxVector.size());
+    return count;
+}
+
+template <class TNextWord>
+std::vector<float> TFastTextEmbedder::CalcWordsEmbedding(TNextWord&& nextWord) const {
+    if (Mode != tg::AM_MATRIX) {
+        std::vector<float> aggregates(3 * Dimension);
+        AggregateWordVectors(nextWord, aggregates.data(), aggregates.data() + Dimension, aggregates.data() + 2 * Dimension);
+        size_t offset = 0;
+        if (Mode == tg::AM_MAX) {
+            offset = Dimension;
+        } else if (Mode == tg::AM_MIN) {
+            offset = 2 * Dimension;
+        }
+        assert(offset != 0 || Mode == tg::AM_AVG);
+        return std::vector<float>(aggregates.begin() + offset, aggregates.begin() + offset + Dimension);
     }
-    assert(Mode == tg::AM_MATRIX);
 
-    int dim = static_cast<int>(vectorSize);
-    auto tensor = torch::zeros({dim * 3}, torch::requires_grad(false));
-    tensor.slice(0, 0, dim) = torch::from_blob(avgVector.data(), {dim});
-    tensor.slice(0, dim, 2 * dim) = torch::from_blob(maxVector.data(), {dim});
-    tensor.slice(0, 2 * dim, 3 * dim) = torch::from_blob(minVector.data(), {dim});
+    // Aggregates are written straight into the model input: average, max and min
+    const int64_t dim = static_cast<int64_t>(Dimension);
+    torch::Tensor tensor = torch::empty({1, dim * 3}, torch::dtype(torch::kFloat32).requires_grad(false));
+    float* tensorData = tensor.data_ptr<float>();
+    AggregateWordVectors(nextWord, tensorData, tensorData + dim, tensorData + 2 * dim);
 
     std::vector<torch::jit::IValue> inputs;
-    inputs.emplace_back(tensor.unsqueeze(0));
+    inputs.emplace_back(std::move(tensor));
 
     at::Tensor outputTensor = Model.forward(inputs).toTensor().squeeze(0).contiguous();
-    float* outputTensorPtr = outputTensor.data_ptr<float>();
-    size_t outputDim = outputTensor.size(0);
-    std::vector<float> resultVector(outputDim);
-    for (size_t i = 0; i < outputDim; i++) {
-        resultVector[i] = outputTensorPtr[i];
-    }
+    const float* outputTensorPtr = outputTensor.data_ptr<float>();
+    return std::vector<float>(outputTensorPtr, outputTensorPtr + outputTensor.size(0));
+}
 
-    return resultVector;
+std::vector<float> TFastTextEmbedder::CalcEmbedding(const std::string& input) const {
+    TTraceSpan span("fasttext_embedding");
+    const char* position = input.data();
+    const char* end = input.data() + input.size();
+    return CalcWordsEmbedding([&position, end](std::string_view& word) {
+        while (position != end && IsSpace(*position)) {
+            ++position;
+        }
+        if (position == end) {
+            return false;
+        }
+        const char* wordBegin = position;
+        while (position != end && !IsSpace(*position)) {
+            ++position;
+        }
+        word = std::string_view(wordBegin, position - wordBegin);
+        return true;
+    });
+}
+
+std::vector<float> TFastTextEmbedder::CalcEmbedding(const TTokenizedDocument& document) const {
+    TTraceSpan span("fasttext_embedding");
+    const TTokenizedDocument::TWords words = document.GetWords(Field);
+    size_t index = 0;
+    return CalcWordsEmbedding([&words, &index](std::string_view& word) {
+        // Empty words stand for empty fields, splitting by spaces skips them
+        while (index < words.Size() && words[index].empty()) {
+            ++index;
+        }
+        if (index == words.Size()) {
+            return false;
+        }
+        word = words[index++];
+        return true;
+    });
 }
@@ -1,11 +1,14 @@
 #pragma once
 
 #include "embedder.h"
+#include "word_vectors_cache.h"
 
 #include <Eigen/Core>
 #include <fasttext.h>
 #include <torch/script.h>
 
+#include <memory>
+
 struct TDocument;
 
 namespace fasttext {
@@ -19,15 +22,31 @@ public:
         tg::EEmbedderField field,
         tg::EAggregationMode mode,
         size_t maxWords,
-        const std::string& modelPath);
+        const std::string& modelPath,
+        size_t cachedWordsCount,
+        const std::string& wordVectorsPath);
 
     explicit TFastTextEmbedder(tg::TEmbedderConfig config);
 
     std::vector<float> CalcEmbedding(const std::string& input) const override;
+    std::vector<float> CalcEmbedding(const TTokenizedDocument& document) const override;
+
+private:
+    // nextWord(word) sets the next word and returns false after the last one
+    template <class TNextWord>
+    std::vector<float> CalcWordsEmbedding(TNextWord&& nextWord) const;
+
+    // Writes the average, max and min of the normalized vectors of the first words to the three
+    // buffers of Dimension floats, returns the number of words aggregated
+    template <class TNextWord>
+    size_t AggregateWordVectors(TNextWord&& nextWord, float* avg, float* max, float* min) const;
 
 private:
     tg::EAggregationMode Mode;
     fasttext::FastText VectorModel;
+    size_t Dimension = 0;
     size_t MaxWords;
     mutable torch::jit::script::Module Model;
+    // Only the words out of it are composed from the subword vectors, nullptr if disabled
+    std::unique_ptr<TWordVectorsCache> WordVectors;
 };
@@ -1,8 +1,24 @@
 #include "tfidf_embedder.h"
+#include "../trace.h"
 #include "../util.h"
 
-#include <sstream>
+#include <torch/script.h>
+
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+namespace {
+    // Basis vectors run through the SVD module at once while loading it
+    constexpr int64_t PROJECTION_BATCH_SIZE = 256;
+    // Random documents the projection is checked on, and their words
+    constexpr size_t PROJECTION_CHECKS_COUNT = 2;
+    constexpr size_t PROJECTION_CHECK_WORDS = 32;
+    constexpr float PROJECTION_TOLERANCE = 1e-3f;
+}
 
 TTfIdfEmbedder::TTfIdfEmbedder(
     const std::string& vocabularyPath
@@ -27,7 +43,7 @@ TTfIdfEmbedder::TTfIdfEmbedder(
     }
 
     if (!modelPath.empty()) {
-        SVDMatrix = torch::jit::load(modelPath);
+        LoadProjection(modelPath);
     }
 
     LOG_DEBUG("TfIdf embedder " << modelPath << " loaded, " << wordIndex << " words")
@@ -40,34 +56,130 @@ TTfIdfEmbedder::TTfIdfEmbedder(tg::TEmbedderConfig config) : TTfIdfEmbedder(
     config.model_path()
 ) {}
 
-std::vector<float> TTfIdfEmbedder::CalcEmbedding(const std::string& input) const {
-    std::vector<size_t> indices = TokenIndexer.Index(input);
-    std::unordered_map<size_t, size_t> wordsCounts;
-    for (size_t wordIndex : indices) {
-        wordsCounts[wordIndex] += 1;
+void TTfIdfEmbedder::LoadProjection(const std::string& modelPath) {
+    // An affine module is recovered once by running it over the basis vectors, and the documents
+    // are projected without Torch. The module is checked to be affine, otherwise it is kept and run.
+    torch::NoGradGuard noGrad;
+    torch::jit::script::Module model = torch::jit::load(modelPath);
+    const auto run = [&model](torch::Tensor input) {
+        std::vector<torch::jit::IValue> inputs;
+        inputs.emplace_back(std::move(input));
+        return model.forward(inputs).toTensor().contiguous();
+    };
+
+    const int64_t vocabularySize = static_cast<int64_t>(TokenIndexer.Size());
+    const at::Tensor bias = run(torch::zeros({1, vocabularySize}));
+    ENSURE(bias.dim() == 2 && bias.size(0) == 1, "Bad SVD model output: " << modelPath);
+    const int64_t dim = bias.size(1);
+    ProjectionBias = Eigen::Map<const Eigen::VectorXf>(bias.data_ptr<float>(), dim);
+
+    Projection.resize(vocabularySize, dim);
+    for (int64_t begin = 0; begin < vocabularySize; begin += PROJECTION_BATCH_SIZE) {
+        const int64_t batchSize = std::min(PROJECTION_BATCH_SIZE, vocabularySize - begin);
+        auto basis = torch::zeros({batchSize, vocabularySize});
+        basis.narrow(1, begin, batchSize).copy_(torch::eye(batchSize));
+        const at::Tensor rows = (run(basis) - bias).contiguous();
+        Projection.middleRows(begin, batchSize) = Eigen::Map<const decltype(Projection)>(rows.data_ptr<float>(), batchSize, dim);
+    }
+
+    if (!IsProjectionExact(model)) {
+        LOG_ERROR("SVD model " << modelPath << " is not affine, it is run for every document");
+        Projection.resize(0, 0);
+        ProjectionBias.resize(0);
+        SVDModule = std::make_unique<torch::jit::script::Module>(std::move(model));
+    }
+}
+
+bool TTfIdfEmbedder::IsProjectionExact(torch::jit::script::Module& model) const {
+    std::mt19937 generator(0);
+    std::uniform_int_distribution<size_t> wordDistribution(0, Idfs.size() - 1);
+    std::uniform_real_distribution<float> tfDistribution(0.0f, 1.0f);
+    for (size_t check = 0; check < PROJECTION_CHECKS_COUNT; ++check) {
+        std::vector<size_t> indices;
+        for (size_t i = 0; i < std::min(PROJECTION_CHECK_WORDS, Idfs.size()); ++i) {
+            indices.push_back(wordDistribution(generator));
+        }
+        std::sort(indices.begin(), indices.end());
+        indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+        std::vector<std::pair<size_t, float>> weights;
+        for (size_t wordIndex : indices) {
+            weights.emplace_back(wordIndex, tfDistribution(generator) * Idfs[wordIndex]);
+        }
+
+        const std::vector<float> expected = RunModule(model, weights);
+        if (expected.size() != static_cast<size_t>(ProjectionBias.size())) {
+            return false;
+        }
+        Eigen::VectorXf projected = ProjectionBias;
+        for (const auto& [wordIndex, weight] : weights) {
+            projected.noalias() += weight * Projection.row(wordIndex).transpose();
+        }
+        const Eigen::Map<const Eigen::VectorXf> expectedVector(expected.data(), expected.size());
+        const float scale = std::max(1.0f, expectedVector.cwiseAbs().maxCoeff());
+        if (!((projected - expectedVector).cwiseAbs().maxCoeff() <= PROJECTION_TOLERANCE * scale)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<float> TTfIdfEmbedder::RunModule(torch::jit::script::Module& model, const std::vector<std::pair<size_t, float>>& weights) const {
+    torch::NoGradGuard noGrad;
+    auto tensor = torch::zeros({1, static_cast<int64_t>(TokenIndexer.Size())});
+    float* tensorData = tensor.data_ptr<float>();
+    for (const auto& [wordIndex, weight] : weights) {
+        tensorData[wordIndex] = weight;
     }
-    std::vector<float> tfIdfVector(TokenIndexer.Size());
-    for (const auto& [wordIndex, wordCount] : wordsCounts) {
-        float tf = static_cast<float>(wordCount) / static_cast<float>(indices.size());
-        tfIdfVector[wordIndex] = tf * Idfs[wordIndex];
+    std::vector<torch::jit::IValue> inputs;
+    inputs.emplace_back(std::move(tensor));
+    const at::Tensor outputTensor = model.forward(inputs).toTensor().contiguous();
+    const float* outputTensorPtr = outputTensor.data_ptr<float>();
+    return std::vector<float>(outputTensorPtr, outputTensorPtr + outputTensor.numel());
+}
+
+std::vector<std::pair<size_t, float>> TTfIdfEmbedder::CalcTfIdf(std::vector<size_t> indices) const {
+    std::sort(indices.begin(), indices.end());
+    std::vector<std::pair<size_t, float>> weights;
+    for (size_t begin = 0, end = 0; begin < indices.size(); begin = end) {
+        while (end < indices.size() && indices[end] == indices[begin]) {
+            ++end;
+        }
+        const size_t wordIndex = indices[begin];
+        float tf = static_cast<float>(end - begin) / static_cast<float>(indices.size());
+        weights.emplace_back(wordIndex, tf * Idfs[wordIndex]);
     }
+    return weights;
+}
+
+std::vector<float> TTfIdfEmbedder::CalcEmbedding(const std::string& input) const {
+    TTraceSpan span("tfidf_embedding");
+    return CalcIndicesEmbedding(TokenIndexer.Index(input));
+}
+
+std::vector<float> TTfIdfEmbedder::CalcEmbedding(const TTokenizedDocument& document) const {
+    TTraceSpan span("tfidf_embedding");
+    return CalcIndicesEmbedding(TokenIndexer.Index(document.GetWords(Field)));
+}
+
+std::vector<float> TTfIdfEmbedder::CalcIndicesEmbedding(std::vector<size_t> indices) const {
+    const std::vector<std::pair<size_t, float>> weights = CalcTfIdf(std::move(indices));
 
     if (!UseMatrix) {
+        std::vector<float> tfIdfVector(TokenIndexer.Size());
+        for (const auto& [wordIndex, weight] : weights) {
+            tfIdfVector[wordIndex] = weight;
+        }
         return tfIdfVector;
     }
-    int dim = static_cast<int>(tfIdfVector.size());
-    auto tensor = torch::zeros({dim}, torch::requires_grad(false));
-    tensor.slice(0, 0, dim) = torch::from_blob(tfIdfVector.data(), {dim});
 
-    std::vector<torch::jit::IValue> inputs;
-    inputs.emplace_back(tensor.unsqueeze(0));
-
-    at::Tensor outputTensor = SVDMatrix.forward(inputs).toTensor().squeeze(0).contiguous();
-    float* outputTensorPtr = outputTensor.data_ptr<float>();
-    size_t outputDim = outputTensor.size(0);
-    std::vector<float> resultVector(outputDim);
-    for (size_t i = 0; i < outputDim; i++) {
-        resultVector[i] = outputTensorPtr[i];
+    if (SVDModule) {
+        return RunModule(*SVDModule, weights);
+    }
+
+    // Only the rows of the document words are touched, O(words * dim) instead of O(vocabulary * dim)
+    Eigen::VectorXf embedding = ProjectionBias;
+    for (const auto& [wordIndex, weight] : weights) {
+        embedding.noalias() += weight * Projection.row(wordIndex).transpose();
     }
-    return resultVector;
+    return std::vector<float>(embedding.data(), embedding.data() + embedding.size());
 }
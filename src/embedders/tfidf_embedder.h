@@ -3,6 +3,11 @@
 #include "embedder.h"
 #include "token_indexer.h"
 
+#include <Eigen/Core>
+
+#include <memory>
+#include <utility>
+
 class TTfIdfEmbedder : public TEmbedder {
 public:
     TTfIdfEmbedder(
@@ -14,10 +19,24 @@ public:
     explicit TTfIdfEmbedder(tg::TEmbedderConfig config);
 
     std::vector<float> CalcEmbedding(const std::string& input) const override;
+    std::vector<float> CalcEmbedding(const TTokenizedDocument& document) const override;
+
+private:
+    std::vector<float> CalcIndicesEmbedding(std::vector<size_t> indices) const;
+    // Nonzero TF-IDF weights of the words, sorted by the word index
+    std::vector<std::pair<size_t, float>> CalcTfIdf(std::vector<size_t> indices) const;
+    void LoadProjection(const std::string& modelPath);
+    // Compares the projection with the module on random sparse vectors
+    bool IsProjectionExact(torch::jit::script::Module& model) const;
+    std::vector<float> RunModule(torch::jit::script::Module& model, const std::vector<std::pair<size_t, float>>& weights) const;
 
 private:
     TTokenIndexer TokenIndexer;
     std::vector<float> Idfs;
     bool UseMatrix;
-    mutable torch::jit::script::Module SVDMatrix;
+    // The SVD module as an affine map: row i is the projection of the i-th word
+    Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> Projection;
+    Eigen::VectorXf ProjectionBias;
+    // Set only if the module is not affine, then it is run for every document
+    std::unique_ptr<torch::jit::script::Module> SVDModule;
 };
@@ -1,44 +1,134 @@
 #include "token_indexer.h"
 #include "../util.h"
 
-#include <boost/algorithm/string.hpp>
-#include <boost/algorithm/string/split.hpp>
-
+#include <algorithm>
 #include <fstream>
+#include <functional>
+
+namespace {
+    uint64_t GetWordHash(std::string_view word) {
+        return std::hash<std::string_view>()(word);
+    }
+}
 
 TTokenIndexer::TTokenIndexer(const std::string& vocabularyPath, size_t maxWords) : MaxWords(maxWords) {
     std::ifstream vocabularyFile(vocabularyPath);
+    std::vector<std::string> vocabulary;
     std::string line;
-    size_t wordIndex = 0;
     while (std::getline(vocabularyFile, line)) {
         size_t found = line.find('\t');
-        const std::string word = (found != std::string::npos) ? line.substr(0, found) : line;
-        ENSURE((wordIndex != 0 || word == "<unk>"), "No <unk> in the vocabulary");
-        Vocabulary[word] = wordIndex;
-        wordIndex++;
+        std::string word = (found != std::string::npos) ? line.substr(0, found) : line;
+        ENSURE((!vocabulary.empty() || word == "<unk>"), "No <unk> in the vocabulary");
+        vocabulary.push_back(std::move(word));
+    }
+
+    size_t slotsCount = 16;
+    while (slotsCount < 2 * vocabulary.size()) {
+        slotsCount *= 2;
+    }
+    Slots.resize(slotsCount);
+    for (size_t wordIndex = 0; wordIndex < vocabulary.size(); wordIndex++) {
+        Insert(vocabulary[wordIndex], wordIndex);
     }
 }
 
-std::vector<size_t> TTokenIndexer::Index(const std::string& text) const {
-    std::vector<std::string> words;
-    boost::split(words, text, boost::is_any_of(" "), boost::token_compress_on);
-    if (words.size() > MaxWords) {
-        words.resize(MaxWords);
+void TTokenIndexer::Insert(std::string_view word, size_t index) {
+    const uint64_t hash = GetWordHash(word);
+    const size_t mask = Slots.size() - 1;
+    for (size_t slotIndex = hash & mask; ; slotIndex = (slotIndex + 1) & mask) {
+        TSlot& slot = Slots[slotIndex];
+        if (slot.Index == EMPTY_SLOT) {
+            ENSURE(Words.size() + word.size() <= UINT32_MAX, "Too large vocabulary");
+            slot.Hash = hash;
+            slot.Offset = static_cast<uint32_t>(Words.size());
+            slot.Length = static_cast<uint32_t>(word.size());
+            slot.Index = index;
+            Words.append(word);
+            WordsCount++;
+            return;
+        }
+        if (slot.Hash == hash && std::string_view(Words).substr(slot.Offset, slot.Length) == word) {
+            // Same as the map it replaced: the last duplicate wins
+            slot.Index = index;
+            return;
+        }
     }
-    std::vector<size_t> result(words.size());
-    for (size_t i = 0; i < words.size(); i++) {
-        auto it = Vocabulary.find(words[i]);
-        result[i] = (it != Vocabulary.end()) ? static_cast<int>(it->second) : 0;
+}
+
+size_t TTokenIndexer::Find(std::string_view word) const {
+    const uint64_t hash = GetWordHash(word);
+    const size_t mask = Slots.size() - 1;
+    for (size_t slotIndex = hash & mask; ; slotIndex = (slotIndex + 1) & mask) {
+        const TSlot& slot = Slots[slotIndex];
+        if (slot.Index == EMPTY_SLOT) {
+            return 0;
+        }
+        if (slot.Hash == hash && std::string_view(Words).substr(slot.Offset, slot.Length) == word) {
+            return slot.Index;
+        }
+    }
+}
+
+// Splits as boost::split with token_compress_on did: runs of spaces are one separator,
+// a leading or trailing space gives an empty word
+template <class TCallback>
+void TTokenIndexer::ForEachIndex(std::string_view text, TCallback&& callback) const {
+    size_t wordsCount = 0;
+    size_t begin = 0;
+    while (wordsCount < MaxWords) {
+        const size_t end = std::min(text.find(' ', begin), text.size());
+        callback(Find(text.substr(begin, end - begin)));
+        wordsCount++;
+        if (end == text.size()) {
+            return;
+        }
+        begin = text.find_first_not_of(' ', end);
+        if (begin == std::string_view::npos) {
+            begin = text.size();
+        }
     }
-    return result;
 }
 
-torch::Tensor TTokenIndexer::IndexTorch(const std::string& text) const {
-    std::vector<size_t> indices = Index(text);
-    torch::Tensor inputs = torch::zeros({static_cast<long long>(indices.size())}, torch::dtype(torch::kLong));
-    for (size_t i = 0; i < indices.size(); i++) {
-        inputs[i] = static_cast<int>(indices[i]);
+template <class TCallback>
+void TTokenIndexer::ForEachIndex(const TTokenizedDocument::TWords& words, TCallback&& callback) const {
+    const size_t wordsCount = std::min(words.Size(), MaxWords);
+    for (size_t i = 0; i < wordsCount; i++) {
+        callback(Find(words[i]));
     }
-    return inputs;
 }
 
+template <class TText>
+std::vector<size_t> TTokenIndexer::IndexImpl(const TText& text) const {
+    std::vector<size_t> result;
+    ForEachIndex(text, [&result](size_t index) {
+        result.push_back(index);
+    });
+    return result;
+}
+
+template <class TText>
+torch::Tensor TTokenIndexer::IndexTorchImpl(const TText& text) const {
+    std::vector<int64_t> indices;
+    ForEachIndex(text, [&indices](size_t index) {
+        indices.push_back(static_cast<int64_t>(index));
+    });
+    // One copy of the whole buffer instead of a dispatched assignment per element
+    const int64_t size = static_cast<int64_t>(indices.size());
+    return torch::from_blob(indices.data(), {size}, torch::dtype(torch::kLong)).clone();
+}
+
+std::vector<size_t> TTokenIndexer::Index(std::string_view text) const {
+    return IndexImpl(text);
+}
+
+std::vector<size_t> TTokenIndexer::Index(const TTokenizedDocument::TWords& words) const {
+    return IndexImpl(words);
+}
+
+torch::Tensor TTokenIndexer::IndexTorch(std::string_view text) const {
+    return IndexTorchImpl(text);
+}
+
+torch::Tensor TTokenIndexer::IndexTorch(const TTokenizedDocument::TWords& words) const {
+    return IndexTorchImpl(words);
+}
@@ -1,19 +1,52 @@
 #pragma once
 
+#include "../tokenized_document.h"
+
 #include <torch/script.h>
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
 class TTokenIndexer {
 public:
     TTokenIndexer(const std::string& vocabularyPath, size_t maxWords);
 
-    std::vector<size_t> Index(const std::string& text) const;
-    torch::Tensor IndexTorch(const std::string& text) const;
-    size_t Size() const { return Vocabulary.size(); }
+    // Indices of the first maxWords space separated words, 0 (<unk>) for the unknown ones
+    std::vector<size_t> Index(std::string_view text) const;
+    torch::Tensor IndexTorch(std::string_view text) const;
+    // Same for the words of a tokenized document
+    std::vector<size_t> Index(const TTokenizedDocument::TWords& words) const;
+    torch::Tensor IndexTorch(const TTokenizedDocument::TWords& words) const;
+    size_t Size() const { return WordsCount; }
+
+private:
+    // Open addressing slot, the word is Words.substr(Offset, Length)
+    struct TSlot {
+        uint64_t Hash = 0;
+        uint32_t Offset = 0;
+        uint32_t Length = 0;
+        size_t Index = EMPTY_SLOT;
+    };
+
+    static constexpr size_t EMPTY_SLOT = static_cast<size_t>(-1);
+
+    void Insert(std::string_view word, size_t index);
+    size_t Find(std::string_view word) const;
+    template <class TCallback>
+    void ForEachIndex(std::string_view text, TCallback&& callback) const;
+    template <class TCallback>
+    void ForEachIndex(const TTokenizedDocument::TWords& words, TCallback&& callback) const;
+    template <class TText>
+    std::vector<size_t> IndexImpl(const TText& text) const;
+    template <class TText>
+    torch::Tensor IndexTorchImpl(const TText& text) const;
 
 private:
-    std::unordered_map<std::string, size_t> Vocabulary;
+    // Linear probing over a power of two table at most half full, so misses end quickly
+    std::vector<TSlot> Slots;
+    std::string Words;
+    size_t WordsCount = 0;
     size_t MaxWords = 0;
 };
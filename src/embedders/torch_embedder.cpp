@@ -1,4 +1,5 @@
 #include "torch_embedder.h"
+#include "../trace.h"
 #include "../util.h"
 
 TTorchEmbedder::TTorchEmbedder(
@@ -22,9 +23,18 @@ TTorchEmbedder::TTorchEmbedder(tg::TEmbedderConfig config) : TTorchEmbedder(
 ) {}
 
 std::vector<float> TTorchEmbedder::CalcEmbedding(const std::string& input) const {
-    auto tensor = TokenIndexer.IndexTorch(input);
+    TTraceSpan span("torch_embedding");
+    return CalcIndicesEmbedding(TokenIndexer.IndexTorch(input));
+}
+
+std::vector<float> TTorchEmbedder::CalcEmbedding(const TTokenizedDocument& document) const {
+    TTraceSpan span("torch_embedding");
+    return CalcIndicesEmbedding(TokenIndexer.IndexTorch(document.GetWords(Field)));
+}
+
+std::vector<float> TTorchEmbedder::CalcIndicesEmbedding(torch::Tensor indices) const {
     std::vector<torch::jit::IValue> inputs;
-    inputs.emplace_back(tensor.unsqueeze(0));
+    inputs.emplace_back(indices.unsqueeze(0));
     at::Tensor outputTensor = Model.forward(inputs).toTensor().squeeze(0).contiguous();
     float* outputTensorPtr = outputTensor.data_ptr<float>();
     size_t size = outputTensor.size(0);
@@ -16,6 +16,10 @@ public:
     explicit TTorchEmbedder(tg::TEmbedderConfig config);
 
     std::vector<float> CalcEmbedding(const std::string& input) const override;
+    std::vector<float> CalcEmbedding(const TTokenizedDocument& document) const override;
+
+private:
+    std::vector<float> CalcIndicesEmbedding(torch::Tensor indices) const;
 
 private:
     mutable torch::jit::script::Module Model;
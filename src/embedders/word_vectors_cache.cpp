@@ -0,0 +1,230 @@
+#include "word_vectors_cache.h"
+#include "../util.h"
+
+#include <boost/filesystem.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+namespace {
+    constexpr char MAGIC[8] = {'N', 'B', 'W', 'V', 'E', 'C', '0', '1'};
+    constexpr size_t ALIGNMENT = 64;
+    // Row of the words whose vectors are too short to be normalized
+    constexpr size_t SKIPPED_WORD_ROW = std::numeric_limits<size_t>::max();
+
+    uint64_t Align(uint64_t offset) {
+        return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+}
+
+// File layout: header, vectors (row per word), WordsCount + 1 offsets of the words in the text,
+// a byte per word set for skipped words, text of the words
+struct TWordVectorsCache::THeader {
+    char Magic[8] = {};
+    // The file is rebuilt when the model changes
+    uint64_t ModelSize = 0;
+    int64_t ModelTime = 0;
+    uint64_t Dimension = 0;
+    uint64_t WordsCount = 0;
+    uint64_t VectorsOffset = 0;
+    uint64_t WordOffsetsOffset = 0;
+    uint64_t SkippedOffset = 0;
+    uint64_t TextOffset = 0;
+    uint64_t Size = 0;
+};
+
+TWordVectorsCache::TWordVectorsCache(
+    const fasttext::FastText& model,
+    const std::string& modelPath,
+    size_t wordsCount,
+    const std::string& path)
+{
+    THeader modelHeader;
+    std::memcpy(modelHeader.Magic, MAGIC, sizeof(MAGIC));
+    boost::system::error_code error;
+    modelHeader.ModelSize = boost::filesystem::file_size(modelPath, error);
+    modelHeader.ModelTime = boost::filesystem::last_write_time(modelPath, error);
+    modelHeader.Dimension = model.getDimension();
+    modelHeader.WordsCount = std::min<size_t>(wordsCount, model.getDictionary()->nwords());
+
+    if (!path.empty() && Map(path, modelHeader)) {
+        if (Index(static_cast<const char*>(MappedData), MappedSize)) {
+            LOG_DEBUG("FastText word vectors mapped from " << path);
+            return;
+        }
+        LOG_ERROR("FastText word vectors in " << path << " are corrupted, rebuilding them");
+        WordRows.clear();
+        munmap(MappedData, MappedSize);
+        MappedData = nullptr;
+        MappedSize = 0;
+    }
+    Data = Build(model, modelHeader);
+    if (!path.empty()) {
+        Save(path);
+    }
+    ENSURE(Index(Data.data(), Data.size()), "Bad FastText word vectors layout");
+}
+
+TWordVectorsCache::~TWordVectorsCache() {
+    if (MappedData) {
+        munmap(MappedData, MappedSize);
+    }
+}
+
+bool TWordVectorsCache::Find(std::string_view word, const float*& vector) const {
+    const auto it = WordRows.find(word);
+    if (it == WordRows.end()) {
+        return false;
+    }
+    vector = it->second != SKIPPED_WORD_ROW ? Vectors + it->second * Dimension : nullptr;
+    return true;
+}
+
+std::vector<char> TWordVectorsCache::Build(const fasttext::FastText& model, const THeader& modelHeader) const {
+    const auto dictionary = model.getDictionary();
+    std::vector<std::string> words;
+    words.reserve(modelHeader.WordsCount);
+    uint64_t textSize = 0;
+    for (size_t i = 0; i < modelHeader.WordsCount; ++i) {
+        words.push_back(dictionary->getWord(i));
+        textSize += words.back().size();
+    }
+
+    THeader header = modelHeader;
+    header.VectorsOffset = Align(sizeof(THeader));
+    header.WordOffsetsOffset = Align(header.VectorsOffset + header.WordsCount * header.Dimension * sizeof(float));
+    header.SkippedOffset = header.WordOffsetsOffset + (header.WordsCount + 1) * sizeof(uint64_t);
+    header.TextOffset = header.SkippedOffset + header.WordsCount;
+    header.Size = header.TextOffset + textSize;
+
+    std::vector<char> data(header.Size);
+    std::memcpy(data.data(), &header, sizeof(THeader));
+    float* vectors = reinterpret_cast<float*>(data.data() + header.VectorsOffset);
+    uint64_t* wordOffsets = reinterpret_cast<uint64_t*>(data.data() + header.WordOffsetsOffset);
+    char* skipped = data.data() + header.SkippedOffset;
+    char* text = data.data() + header.TextOffset;
+
+    fasttext::Vector wordVector(header.Dimension);
+    uint64_t textOffset = 0;
+    for (size_t i = 0; i < words.size(); ++i) {
+        wordOffsets[i] = textOffset;
+        std::memcpy(text + textOffset, words[i].data(), words[i].size());
+        textOffset += words[i].size();
+
+        model.getWordVector(wordVector, words[i]);
+        const float norm = wordVector.norm();
+        skipped[i] = norm < MIN_WORD_NORM;
+        if (!skipped[i]) {
+            wordVector.mul(1.0f / norm);
+            std::memcpy(vectors + i * header.Dimension, wordVector.data(), header.Dimension * sizeof(float));
+        }
+    }
+    wordOffsets[words.size()] = textOffset;
+    LOG_DEBUG("FastText vectors of " << words.size() << " words computed");
+    return data;
+}
+
+bool TWordVectorsCache::Map(const std::string& path, const THeader& modelHeader) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat fileStat;
+    const bool isValidSize = fstat(fd, &fileStat) == 0 && static_cast<size_t>(fileStat.st_size) >= sizeof(THeader);
+    void* data = isValidSize ? mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    THeader header;
+    std::memcpy(&header, data, sizeof(THeader));
+    const bool isValid = std::memcmp(header.Magic, MAGIC, sizeof(MAGIC)) == 0
+        && header.ModelSize == modelHeader.ModelSize
+        && header.ModelTime == modelHeader.ModelTime
+        && header.Dimension == modelHeader.Dimension
+        && header.WordsCount == modelHeader.WordsCount
+        && header.Size == static_cast<uint64_t>(fileStat.st_size)
+        && header.VectorsOffset % ALIGNMENT == 0
+        && header.WordOffsetsOffset % ALIGNMENT == 0
+        // Offsets within the file first, so that the sums below do not overflow
+        && header.VectorsOffset <= header.Size
+        && header.WordOffsetsOffset <= header.Size
+        && header.SkippedOffset <= header.Size
+        && header.VectorsOffset >= sizeof(THeader)
+        && header.VectorsOffset + header.WordsCount * header.Dimension * sizeof(float) <= header.WordOffsetsOffset
+        && header.WordOffsetsOffset + (header.WordsCount + 1) * sizeof(uint64_t) <= header.SkippedOffset
+        && header.SkippedOffset + header.WordsCount <= header.TextOffset
+        && header.TextOffset <= header.Size;
+    if (!isValid) {
+        LOG_DEBUG("FastText word vectors in " << path << " are stale");
+        munmap(data, fileStat.st_size);
+        return false;
+    }
+    MappedData = data;
+    MappedSize = fileStat.st_size;
+    return true;
+}
+
+void TWordVectorsCache::Save(const std::string& path) const {
+    // Written to a file of this process and renamed once synced, so that a concurrent start
+    // never maps a partial file, and concurrent writers do not write into the same one
+    std::string tmpPath = path + ".XXXXXX";
+    const int fd = mkstemp(tmpPath.data());
+    if (fd == -1) {
+        LOG_ERROR("Could not create a temporary file for FastText word vectors next to " << path);
+        return;
+    }
+    bool isWritten = fchmod(fd, 0644) == 0;
+    for (size_t written = 0; isWritten && written < Data.size();) {
+        const ssize_t result = write(fd, Data.data() + written, Data.size() - written);
+        if (result == -1 && errno == EINTR) {
+            continue;
+        }
+        isWritten = result > 0;
+        written += isWritten ? result : 0;
+    }
+    isWritten = isWritten && fsync(fd) == 0;
+    isWritten = close(fd) == 0 && isWritten;
+    if (!isWritten) {
+        LOG_ERROR("Could not write FastText word vectors to " << tmpPath);
+        unlink(tmpPath.c_str());
+        return;
+    }
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        LOG_ERROR("Could not rename " << tmpPath << " to " << path);
+        unlink(tmpPath.c_str());
+    }
+}
+
+bool TWordVectorsCache::Index(const char* data, size_t size) {
+    // The sections are checked by Map, the words are checked here, as the file may be corrupted
+    THeader header;
+    std::memcpy(&header, data, sizeof(THeader));
+    Dimension = header.Dimension;
+    Vectors = reinterpret_cast<const float*>(data + header.VectorsOffset);
+    const uint64_t* wordOffsets = reinterpret_cast<const uint64_t*>(data + header.WordOffsetsOffset);
+    const char* skipped = data + header.SkippedOffset;
+    const char* text = data + header.TextOffset;
+    const uint64_t textSize = size - header.TextOffset;
+    if (wordOffsets[0] != 0) {
+        return false;
+    }
+    WordRows.reserve(header.WordsCount);
+    for (size_t i = 0; i < header.WordsCount; ++i) {
+        if (wordOffsets[i + 1] < wordOffsets[i] || wordOffsets[i + 1] > textSize) {
+            return false;
+        }
+        const std::string_view word(text + wordOffsets[i], wordOffsets[i + 1] - wordOffsets[i]);
+        WordRows.emplace(word, skipped[i] ? SKIPPED_WORD_ROW : i);
+    }
+    return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <fasttext.h>
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Normalized vectors of the most frequent words of a fastText model, which getWordVector
+// would otherwise sum from the subword vectors on every occurrence.
+class TWordVectorsCache {
+public:
+    // Vectors of the first wordsCount words of the dictionary, which is sorted by frequency.
+    // If path is not empty, they are mapped from that file; it is written first if it is
+    // missing or was made for another model.
+    TWordVectorsCache(
+        const fasttext::FastText& model,
+        const std::string& modelPath,
+        size_t wordsCount,
+        const std::string& path);
+    ~TWordVectorsCache();
+
+    TWordVectorsCache(const TWordVectorsCache&) = delete;
+    TWordVectorsCache& operator=(const TWordVectorsCache&) = delete;
+
+    // False if the word is not cached. The vector is nullptr for the words too short to be normalized.
+    bool Find(std::string_view word, const float*& vector) const;
+    size_t Size() const { return WordRows.size(); }
+
+    static constexpr float MIN_WORD_NORM = 0.0001f;
+
+private:
+    struct THeader;
+
+    std::vector<char> Build(const fasttext::FastText& model, const THeader& modelHeader) const;
+    bool Map(const std::string& path, const THeader& modelHeader);
+    void Save(const std::string& path) const;
+    // False if the offsets of the words are out of the data
+    bool Index(const char* data, size_t size);
+
+private:
+    // Either built in memory or mapped from the file, the layout is the same
+    std::vector<char> Data;
+    void* MappedData = nullptr;
+    size_t MappedSize = 0;
+
+    const float* Vectors = nullptr;
+    size_t Dimension = 0;
+    // Views of the words in the data to rows of Vectors
+    std::unordered_map<std::string_view, size_t> WordRows;
+};
@@ -0,0 +1,37 @@
+#include "executor.h"
+
+#include "thread_pool.h"
+#include "util.h"
+
+#include <ATen/Parallel.h>
+#include <Eigen/Core>
+
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+void ConfigureExecutor(const tg::TExecutorConfig& config) {
+    TThreadPoolOptions options;
+    if (config.threads() != 0) {
+        options.ThreadsCount = config.threads();
+    }
+    options.Cpus.assign(config.cpus().begin(), config.cpus().end());
+    options.NumaAware = config.numa_aware();
+    if (!TThreadPool::ConfigureShared(options)) {
+        return;
+    }
+
+    // Tasks of the pool already keep every core busy, parallel regions inside them only add threads
+    const int intraOpThreads = std::max<int>(1, config.intra_op_threads());
+    at::set_num_threads(intraOpThreads);
+#ifdef _OPENMP
+    omp_set_num_threads(intraOpThreads);
+#endif
+    Eigen::setNbThreads(intraOpThreads);
+    const TThreadPool& threadPool = TThreadPool::GetShared();
+    LOG_DEBUG("Executor threads: " << threadPool.GetThreadsCount()
+        << ", NUMA nodes: " << threadPool.GetNodesCount()
+        << ", intra-op threads: " << intraOpThreads);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "config.pb.h"
+
+// Creates the shared thread pool and sets the thread counts of LibTorch, OpenMP and Eigen,
+// so the runnable threads of all three stay within the budget of the config.
+// Only the first call has an effect, later ones are ignored.
+void ConfigureExecutor(const tg::TExecutorConfig& config);
@@ -1,20 +1,150 @@
 #pragma once
 
+#include "util.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <thread>
 
+// Single writer, many readers state with epoch based reclamation.
+// A reader announces the global epoch in its own cache line and then loads the pointer,
+// so reads do not write to any shared memory. The writer swaps the pointer, advances the epoch
+// and waits until every reader that could have seen the previous state leaves its read section.
+// Thread indices are reused after the threads exit, so only more than MAX_READERS live threads overflow
+// the slots. Such readers share two counters, one per epoch parity, and the writer waits only for the
+// counter of the readers that started before the swap.
 template<class T>
 class THotState {
 public:
-    THotState() = default;
+    static constexpr size_t MAX_READERS = 256;
+
+    class TReadGuard {
+    public:
+        TReadGuard(const TReadGuard&) = delete;
+        TReadGuard& operator=(const TReadGuard&) = delete;
+
+        TReadGuard(TReadGuard&& other)
+            : State(other.State)
+            , Slot(other.Slot)
+            , Overflow(other.Overflow)
+            , Ptr(other.Ptr)
+        {
+            other.State = nullptr;
+        }
+
+        ~TReadGuard() {
+            if (!State || !Slot) {
+                return;
+            }
+            if (Overflow) {
+                Slot->fetch_sub(1, std::memory_order_release);
+            } else {
+                Slot->store(0, std::memory_order_release);
+            }
+        }
+
+        const T* get() const { return Ptr; }
+        const T& operator*() const { return *Ptr; }
+        const T* operator->() const { return Ptr; }
+        explicit operator bool() const { return Ptr != nullptr; }
 
-    std::shared_ptr<T> AtomicGet() const {
-        return std::atomic_load(&StatePtr);
+    private:
+        friend class THotState;
+
+        TReadGuard(const THotState* state, std::atomic<uint64_t>* slot, bool overflow)
+            : State(state)
+            , Slot(slot)
+            , Overflow(overflow)
+        {
+        }
+
+    private:
+        const THotState* State = nullptr;
+        // Slot owned by this guard or the overflow counter it has incremented, nullptr for nested reads
+        std::atomic<uint64_t>* Slot = nullptr;
+        bool Overflow = false;
+        const T* Ptr = nullptr;
+    };
+
+public:
+    THotState()
+        : Slots(std::make_unique<TSlot[]>(MAX_READERS))
+    {
     }
 
-    void AtomicSet(std::shared_ptr<T> newStatePtr) {
-        std::atomic_store(&StatePtr, newStatePtr);
+    ~THotState() {
+        delete StatePtr.load(std::memory_order_relaxed);
     }
 
+    THotState(const THotState&) = delete;
+    THotState& operator=(const THotState&) = delete;
+
+    // The state stays alive until the guard is destroyed
+    TReadGuard AtomicGet() const {
+        const size_t threadIndex = GetThreadIndex();
+        if (threadIndex >= MAX_READERS) {
+            // The counter of the epoch is incremented only if the epoch has not advanced meanwhile,
+            // otherwise a writer of the next epoch would not wait for it
+            while (true) {
+                const uint64_t globalEpoch = GlobalEpoch.load(std::memory_order_seq_cst);
+                std::atomic<uint64_t>& counter = OverflowReaders[globalEpoch % 2].Epoch;
+                counter.fetch_add(1, std::memory_order_seq_cst);
+                if (GlobalEpoch.load(std::memory_order_seq_cst) == globalEpoch) {
+                    TReadGuard guard(this, &counter, true);
+                    guard.Ptr = StatePtr.load(std::memory_order_seq_cst);
+                    return guard;
+                }
+                counter.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+
+        std::atomic<uint64_t>& epoch = Slots[threadIndex].Epoch;
+        if (epoch.load(std::memory_order_relaxed) != 0) {
+            // Nested read, the outer one already protects this and all later states
+            TReadGuard guard(this, nullptr, false);
+            guard.Ptr = StatePtr.load(std::memory_order_seq_cst);
+            return guard;
+        }
+        // Acquire pairs with the increment in AtomicSet: a reader which publishes the new epoch must also
+        // see the state exchanged before it, as the writer does not wait for such readers
+        epoch.store(GlobalEpoch.load(std::memory_order_acquire), std::memory_order_seq_cst);
+        TReadGuard guard(this, &epoch, false);
+        guard.Ptr = StatePtr.load(std::memory_order_seq_cst);
+        return guard;
+    }
+
+    // Returns the previous state once no reader can access it
+    std::unique_ptr<T> AtomicSet(std::unique_ptr<T> newState) {
+        T* oldState = StatePtr.exchange(newState.release(), std::memory_order_seq_cst);
+        const uint64_t newEpoch = GlobalEpoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+        for (size_t i = 0; i < MAX_READERS; ++i) {
+            while (true) {
+                const uint64_t readerEpoch = Slots[i].Epoch.load(std::memory_order_seq_cst);
+                if (readerEpoch == 0 || readerEpoch >= newEpoch) {
+                    break;
+                }
+                std::this_thread::yield();
+            }
+        }
+        // Overflow readers of the new epoch see the new state, so they are not waited for
+        while (OverflowReaders[(newEpoch - 1) % 2].Epoch.load(std::memory_order_seq_cst) != 0) {
+            std::this_thread::yield();
+        }
+        return std::unique_ptr<T>(oldState);
+    }
+
+private:
+    struct alignas(64) TSlot {
+        // Epoch observed at the start of the read section, 0 outside of it.
+        // For the overflow counters, the number of readers in the read sections of the epoch parity.
+        std::atomic<uint64_t> Epoch {0};
+    };
+
 private:
-    std::shared_ptr<T> StatePtr;
+    std::atomic<T*> StatePtr {nullptr};
+    alignas(64) std::atomic<uint64_t> GlobalEpoch {1};
+    mutable std::array<TSlot, 2> OverflowReaders;
+    std::unique_ptr<TSlot[]> Slots;
 };
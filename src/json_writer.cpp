@@ -0,0 +1,140 @@
+#include "json_writer.h"
+
+#include <nlohmann_json/json.hpp>
+
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+
+TJsonWriter::TJsonWriter(std::string& buffer, int indent)
+    : Buffer(buffer)
+    , Indent(indent)
+{
+}
+
+TJsonWriter& TJsonWriter::BeginObject() {
+    return Begin('{');
+}
+
+TJsonWriter& TJsonWriter::EndObject() {
+    return End('}');
+}
+
+TJsonWriter& TJsonWriter::BeginArray() {
+    return Begin('[');
+}
+
+TJsonWriter& TJsonWriter::EndArray() {
+    return End(']');
+}
+
+TJsonWriter& TJsonWriter::Key(std::string_view key) {
+    BeforeValue();
+    WriteEscaped(key);
+    Buffer += Indent < 0 ? ":" : ": ";
+    AfterKey = true;
+    return *this;
+}
+
+TJsonWriter& TJsonWriter::String(std::string_view value) {
+    BeforeValue();
+    WriteEscaped(value);
+    return *this;
+}
+
+TJsonWriter& TJsonWriter::Int(int64_t value) {
+    BeforeValue();
+    std::array<char, 32> number;
+    const int size = std::snprintf(number.data(), number.size(), "%lld", static_cast<long long>(value));
+    Buffer.append(number.data(), size);
+    return *this;
+}
+
+TJsonWriter& TJsonWriter::Double(double value) {
+    BeforeValue();
+    if (!std::isfinite(value)) {
+        Buffer += "null";
+        return *this;
+    }
+    std::array<char, 64> number;
+    char* end = nlohmann::detail::to_chars(number.data(), number.data() + number.size(), value);
+    Buffer.append(number.data(), end - number.data());
+    return *this;
+}
+
+TJsonWriter& TJsonWriter::Raw(std::string_view json) {
+    BeforeValue();
+    Buffer += json;
+    return *this;
+}
+
+TJsonWriter& TJsonWriter::Begin(char bracket) {
+    BeforeValue();
+    Buffer += bracket;
+    HasElements.push_back(false);
+    return *this;
+}
+
+TJsonWriter& TJsonWriter::End(char bracket) {
+    assert(!HasElements.empty() && !AfterKey);
+    const bool hasElements = HasElements.back();
+    HasElements.pop_back();
+    if (hasElements) {
+        NewLine(HasElements.size());
+    }
+    Buffer += bracket;
+    return *this;
+}
+
+void TJsonWriter::BeforeValue() {
+    if (AfterKey) {
+        AfterKey = false;
+        return;
+    }
+    if (HasElements.empty()) {
+        return;
+    }
+    if (HasElements.back()) {
+        Buffer += ',';
+    }
+    HasElements.back() = true;
+    NewLine(HasElements.size());
+}
+
+void TJsonWriter::NewLine(size_t depth) {
+    if (Indent < 0) {
+        return;
+    }
+    Buffer += '\n';
+    Buffer.append(depth * Indent, ' ');
+}
+
+void TJsonWriter::WriteEscaped(std::string_view value) {
+    Buffer += '"';
+    size_t runBegin = 0;
+    for (size_t i = 0; i < value.size(); ++i) {
+        const char c = value[i];
+        if (static_cast<unsigned char>(c) > 0x1F && c != '"' && c != '\\') {
+            continue;
+        }
+        Buffer.append(value.data() + runBegin, i - runBegin);
+        runBegin = i + 1;
+        switch (c) {
+            case '\b': Buffer += "\\b"; break;
+            case '\t': Buffer += "\\t"; break;
+            case '\n': Buffer += "\\n"; break;
+            case '\f': Buffer += "\\f"; break;
+            case '\r': Buffer += "\\r"; break;
+            case '"': Buffer += "\\\""; break;
+            case '\\': Buffer += "\\\\"; break;
+            default: {
+                std::array<char, 8> escaped;
+                std::snprintf(escaped.data(), escaped.size(), "\\u%04x", static_cast<unsigned int>(c));
+                Buffer.append(escaped.data(), 6);
+            }
+        }
+    }
+    Buffer.append(value.data() + runBegin, value.size() - runBegin);
+    Buffer += '"';
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Streaming JSON writer appending to a caller-owned buffer, no intermediate DOM is built.
+// Strings and numbers are formatted as in nlohmann::json::dump, so with keys written in sorted order
+// the output is byte-identical to dump(indent) of the equivalent nlohmann::json.
+class TJsonWriter {
+public:
+    // Negative indent means compact output
+    explicit TJsonWriter(std::string& buffer, int indent = -1);
+
+    TJsonWriter& BeginObject();
+    TJsonWriter& EndObject();
+    TJsonWriter& BeginArray();
+    TJsonWriter& EndArray();
+
+    TJsonWriter& Key(std::string_view key);
+
+    TJsonWriter& String(std::string_view value);
+    TJsonWriter& Int(int64_t value);
+    TJsonWriter& Double(double value);
+
+    // Already serialized compact JSON value
+    TJsonWriter& Raw(std::string_view json);
+
+private:
+    TJsonWriter& Begin(char bracket);
+    TJsonWriter& End(char bracket);
+    void BeforeValue();
+    void NewLine(size_t depth);
+    void WriteEscaped(std::string_view value);
+
+private:
+    std::string& Buffer;
+    int Indent = -1;
+    std::vector<bool> HasElements;
+    bool AfterKey = false;
+};
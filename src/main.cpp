@@ -1,9 +1,12 @@
 #include "annotator.h"
+#include "bench_server.h"
 #include "clusterer.h"
+#include "json_writer.h"
 #include "ranker.h"
 #include "run_server.h"
 #include "summarizer.h"
 #include "timer.h"
+#include "trace.h"
 #include "util.h"
 
 #include <boost/algorithm/string/predicate.hpp>
@@ -28,6 +31,13 @@ int main(int argc, char** argv) {
             ("languages", po::value<std::vector<std::string>>()->multitoken()->default_value(std::vector<std::string>{"ru", "en"}, "ru en"), "languages")
             ("window_size", po::value<uint64_t>()->default_value(3600*8), "window_size")
             ("print_top_debug_info", po::bool_switch()->default_value(false), "print_top_debug_info")
+            ("trace", po::value<std::string>()->default_value(""), "trace")
+            ("bench_url", po::value<std::string>()->default_value("http://127.0.0.1:8000"), "bench_url")
+            ("bench_rate", po::value<double>()->default_value(100.0), "bench_rate")
+            ("bench_duration", po::value<uint64_t>()->default_value(30), "bench_duration")
+            ("bench_connections", po::value<size_t>()->default_value(16), "bench_connections")
+            ("bench_mix", po::value<std::string>()->default_value("put:50,post:10,delete:10,threads:30"), "bench_mix")
+            ("bench_seed", po::value<uint64_t>()->default_value(42), "bench_seed")
             ;
 
         po::positional_options_description p;
@@ -55,13 +65,16 @@ int main(int argc, char** argv) {
             "categories",
             "threads",
             "top",
-            "server"
+            "server",
+            "bench-server"
         };
         if (std::find(modes.begin(), modes.end(), mode) == modes.end()) {
             std::cerr << "Unknown or unsupported mode!" << std::endl;
             return -1;
         }
 
+        const TTraceSession traceSession(vm["trace"].as<std::string>());
+
         if (mode == "server") {
             const std::string serverConfig = vm["server_config"].as<std::string>();
 
@@ -103,6 +116,21 @@ int main(int argc, char** argv) {
             LOG_DEBUG("Files count: " << fileNames.size());
         }
 
+        if (mode == "bench-server") {
+            if (inputFormat != tg::IF_HTML) {
+                std::cerr << "Server benchmark needs a directory with html files" << std::endl;
+                return -1;
+            }
+            TServerBenchOptions options;
+            options.Url = vm["bench_url"].as<std::string>();
+            options.Rate = vm["bench_rate"].as<double>();
+            options.DurationSec = vm["bench_duration"].as<uint64_t>();
+            options.Connections = vm["bench_connections"].as<size_t>();
+            options.Mix = vm["bench_mix"].as<std::string>();
+            options.Seed = vm["bench_seed"].as<uint64_t>();
+            return RunServerBench(fileNames, options);
+        }
+
         // Parse files and annotate with classifiers
         const std::string annotatorConfigPath = vm["annotator_config"].as<std::string>();
         bool saveNotNews = vm["save_not_news"].as<bool>();
@@ -179,28 +207,31 @@ int main(int argc, char** argv) {
             assert(false);
         }
 
-        // Clustering
+        // Clustering (and summarization for the top mode)
         const std::string clustererConfigPath = vm["clusterer_config"].as<std::string>();
         TClusterer clusterer(clustererConfigPath);
+        std::unique_ptr<TSummarizer> summarizer;
+        if (mode == "top") {
+            const std::string summarizerConfigPath = vm["summarizer_config"].as<std::string>();
+            summarizer = std::make_unique<TSummarizer>(summarizerConfigPath);
+        }
         TTimer<std::chrono::high_resolution_clock, std::chrono::milliseconds> clusteringTimer;
-        TClusterIndex clusterIndex = clusterer.Cluster(std::move(docs));
+        TClusterIndex clusterIndex = clusterer.Cluster(std::move(docs), summarizer.get());
         LOG_DEBUG("Clustering: " << clusteringTimer.Elapsed() << " ms")
         for (const auto& [language, langClusters]: clusterIndex.Clusters) {
             LOG_DEBUG(nlohmann::json(language) << ": " << langClusters.size() << " clusters");
         }
         if (mode == "threads") {
-            nlohmann::json outputJson = nlohmann::json::array();
+            std::string output;
+            TJsonWriter writer(output, 4);
+            writer.BeginArray();
             for (const auto& [language, langClusters]: clusterIndex.Clusters) {
                 for (const auto& cluster : langClusters) {
-                    nlohmann::json files = nlohmann::json::array();
+                    writer.BeginObject().Key("articles").BeginArray();
                     for (const TDbDocument& doc : cluster.GetDocuments()) {
-                        files.push_back(CleanFileName(doc.FileName));
+                        writer.String(CleanFileName(doc.FileName));
                     }
-                    nlohmann::json object = {
-                        {"title", cluster.GetTitle()},
-                        {"articles", files}
-                    };
-                    outputJson.push_back(object);
+                    writer.EndArray().Key("title").String(cluster.GetTitle()).EndObject();
 
                     if (cluster.GetSize() >= 2) {
                     	LOG_DEBUG("\n         CLUSTER: " << cluster.GetTitle());
@@ -210,7 +241,8 @@ int main(int argc, char** argv) {
                     }
                 }
             }
-            std::cout << outputJson.dump(4) << std::endl;
+            writer.EndArray();
+            std::cout << output << std::endl;
             return 0;
         } else if (mode != "top") {
             assert(false);
@@ -219,15 +251,12 @@ int main(int argc, char** argv) {
         // Ranking
         uint64_t window = vm["window_size"].as<uint64_t>();
         bool printTopDebugInfo = vm["print_top_debug_info"].as<bool>();
-        const std::string summarizerConfigPath = vm["summarizer_config"].as<std::string>();
-        const TSummarizer summarizer(summarizerConfigPath);
 
         TClusters allClusters;
         for (const auto& language: {tg::LN_EN, tg::LN_RU}) {
             if (clusterIndex.Clusters.find(language) == clusterIndex.Clusters.end()) {
                 continue;
             }
-            summarizer.Summarize(clusterIndex.Clusters.at(language));
             std::copy(
                 clusterIndex.Clusters.at(language).cbegin(),
                 clusterIndex.Clusters.at(language).cend(),
@@ -238,7 +267,10 @@ int main(int argc, char** argv) {
         const std::string rankerConfigPath = vm["ranker_config"].as<std::string>();
         const TRanker ranker(rankerConfigPath);
         const auto tops = ranker.Rank(allClusters.begin(), allClusters.end(), clusterIndex.IterTimestamp, window);
-        nlohmann::json outputJson = nlohmann::json::array();
+        // Keys are written in the sorted order, as nlohmann::json does
+        std::string output;
+        TJsonWriter writer(output, 4);
+        writer.BeginArray();
         for (auto it = tops.begin(); it != tops.end(); ++it) {
             const auto category = static_cast<tg::ECategory>(std::distance(tops.begin(), it));
             if (category == tg::NC_UNDEFINED) {
@@ -248,46 +280,52 @@ int main(int argc, char** argv) {
                 continue;
             }
 
-            nlohmann::json rubricTop = {
-                {"category", category},
-                {"threads", nlohmann::json::array()}
-            };
-            for (const auto& cluster : *it) {
-                nlohmann::json object = {
-                    {"title", cluster.Cluster.get().GetTitle()},
-                    {"category", cluster.Cluster.get().GetCategory()},
-                    {"articles", nlohmann::json::array()},
-                };
-                for (const TDbDocument& doc : cluster.Cluster.get().GetDocuments()) {
-                    object["articles"].push_back(CleanFileName(doc.FileName));
-                }
+            writer.BeginObject().Key("category").String(ToString(category)).Key("threads").BeginArray();
+            for (const auto& weightedCluster : *it) {
+                const TNewsCluster& cluster = weightedCluster.Cluster.get();
+                const TWeightInfo& weightInfo = weightedCluster.WeightInfo;
+                writer.BeginObject();
                 if (printTopDebugInfo) {
-                    object["article_weights"] = nlohmann::json::array();
-                    object["features"] = nlohmann::json::array();
-                    object["weight"] = cluster.WeightInfo.Weight;
-                    object["importance"] = cluster.WeightInfo.Importance;
-                    object["best_time"] = cluster.WeightInfo.BestTime;
-                    object["age_penalty"] = cluster.WeightInfo.AgePenalty;
-                    object["average_us"] = cluster.Cluster.get().GetCountryShare().at("US");
-                    object["w_average_us"] = cluster.Cluster.get().GetWeightedCountryShare().at("US");
-                    object["average_gb"] = cluster.Cluster.get().GetCountryShare().at("GB");
-                    object["w_average_gb"] = cluster.Cluster.get().GetWeightedCountryShare().at("GB");
-                    object["average_in"] = cluster.Cluster.get().GetCountryShare().at("IN");
-                    object["w_average_in"] = cluster.Cluster.get().GetWeightedCountryShare().at("IN");
-
-                    for (const auto& weight : cluster.Cluster.get().GetDocWeights()) {
-                        object["article_weights"].push_back(weight);
+                    writer.Key("age_penalty").Double(weightInfo.AgePenalty);
+                    writer.Key("article_weights").BeginArray();
+                    for (const auto& weight : cluster.GetDocWeights()) {
+                        writer.Double(weight);
                     }
-                    for (const auto& feature : cluster.Cluster.get().GetFeatures()) {
-                        object["features"].push_back(feature);
+                    writer.EndArray();
+                }
+                writer.Key("articles").BeginArray();
+                for (const TDbDocument& doc : cluster.GetDocuments()) {
+                    writer.String(CleanFileName(doc.FileName));
+                }
+                writer.EndArray();
+                if (printTopDebugInfo) {
+                    writer.Key("average_gb").Double(cluster.GetCountryShare().at("GB"));
+                    writer.Key("average_in").Double(cluster.GetCountryShare().at("IN"));
+                    writer.Key("average_us").Double(cluster.GetCountryShare().at("US"));
+                    writer.Key("best_time").Int(weightInfo.BestTime);
+                }
+                writer.Key("category").String(ToString(cluster.GetCategory()));
+                if (printTopDebugInfo) {
+                    writer.Key("features").BeginArray();
+                    for (const auto& feature : cluster.GetFeatures()) {
+                        writer.Double(feature);
                     }
-
+                    writer.EndArray();
+                    writer.Key("importance").Double(weightInfo.Importance);
+                }
+                writer.Key("title").String(cluster.GetTitle());
+                if (printTopDebugInfo) {
+                    writer.Key("w_average_gb").Double(cluster.GetWeightedCountryShare().at("GB"));
+                    writer.Key("w_average_in").Double(cluster.GetWeightedCountryShare().at("IN"));
+                    writer.Key("w_average_us").Double(cluster.GetWeightedCountryShare().at("US"));
+                    writer.Key("weight").Double(weightInfo.Weight);
                 }
-                rubricTop["threads"].push_back(object);
+                writer.EndObject();
             }
-            outputJson.push_back(rubricTop);
+            writer.EndArray().EndObject();
         }
-        std::cout << outputJson.dump(4) << std::endl;
+        writer.EndArray();
+        std::cout << output << std::endl;
         return 0;
     } catch (std::exception& e) {
         std::cerr << e.what() << std::endl;
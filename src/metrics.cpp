@@ -0,0 +1,244 @@
+#include "metrics.h"
+#include "util.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <thread>
+
+namespace {
+
+    // Shards are allocated for every metric, so their number is bounded
+    constexpr size_t MIN_SHARDS_COUNT = 16;
+    constexpr size_t MAX_SHARDS_COUNT = 256;
+
+    size_t GetShardIndex() {
+        // The count is a power of two
+        return GetThreadIndex() & (GetMetricsShardsCount() - 1);
+    }
+
+    void WriteDouble(double value, std::string& output) {
+        std::array<char, 32> number;
+        const int size = std::snprintf(number.data(), number.size(), "%.9g", value);
+        output.append(number.data(), size);
+    }
+
+    std::string SerializeLabels(const TMetricLabels& labels) {
+        std::string result;
+        for (const auto& [name, value] : labels) {
+            result += result.empty() ? "" : ",";
+            result += name;
+            result += "=\"";
+            for (const char c : value) {
+                if (c == '\\' || c == '"') {
+                    result += '\\';
+                    result += c;
+                } else if (c == '\n') {
+                    result += "\\n";
+                } else {
+                    result += c;
+                }
+            }
+            result += '"';
+        }
+        return result;
+    }
+
+    void WriteHeader(const std::string& name, const std::string& help, const char* type, std::string& output) {
+        output += "# HELP " + name + " " + help + "\n";
+        output += "# TYPE " + name + " " + type + "\n";
+    }
+
+    // Writes "name{labels,extraLabel} "
+    void WriteName(
+        const std::string& name,
+        const std::string& labels,
+        const std::string& extraLabel,
+        std::string& output)
+    {
+        output += name;
+        if (!labels.empty() || !extraLabel.empty()) {
+            output += '{';
+            output += labels;
+            output += !labels.empty() && !extraLabel.empty() ? "," : "";
+            output += extraLabel;
+            output += '}';
+        }
+        output += ' ';
+    }
+
+}
+
+size_t GetMetricsShardsCount() {
+    // Pool workers, server IO threads and the clustering threads together are a few per core
+    static const size_t shardsCount = [] {
+        size_t count = MIN_SHARDS_COUNT;
+        while (count < 2 * std::thread::hardware_concurrency() && count < MAX_SHARDS_COUNT) {
+            count *= 2;
+        }
+        return count;
+    }();
+    return shardsCount;
+}
+
+TCounter::TCounter()
+    : Shards(std::make_unique<TShard[]>(GetMetricsShardsCount()))
+{
+}
+
+void TCounter::Add(uint64_t value) {
+    Shards[GetShardIndex()].Value.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t TCounter::Get() const {
+    uint64_t result = 0;
+    for (size_t shardIndex = 0; shardIndex < GetMetricsShardsCount(); ++shardIndex) {
+        result += Shards[shardIndex].Value.load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+void TGauge::Set(double value) {
+    Value.store(value, std::memory_order_relaxed);
+}
+
+double TGauge::Get() const {
+    return Value.load(std::memory_order_relaxed);
+}
+
+THistogram::THistogram()
+    : Shards(std::make_unique<TShard[]>(GetMetricsShardsCount()))
+{
+}
+
+void THistogram::Record(uint64_t valueUs) {
+    TShard& shard = Shards[GetShardIndex()];
+    shard.Buckets[GetBucket(valueUs)].fetch_add(1, std::memory_order_relaxed);
+    shard.Sum.fetch_add(valueUs, std::memory_order_relaxed);
+}
+
+THistogram::TSnapshot THistogram::GetSnapshot() const {
+    TSnapshot snapshot;
+    snapshot.Buckets.assign(BUCKETS_COUNT, 0);
+    for (size_t shardIndex = 0; shardIndex < GetMetricsShardsCount(); ++shardIndex) {
+        const TShard& shard = Shards[shardIndex];
+        for (size_t bucket = 0; bucket < BUCKETS_COUNT; ++bucket) {
+            snapshot.Buckets[bucket] += shard.Buckets[bucket].load(std::memory_order_relaxed);
+        }
+        snapshot.Sum += shard.Sum.load(std::memory_order_relaxed);
+    }
+    return snapshot;
+}
+
+size_t THistogram::GetBucket(uint64_t valueUs) {
+    if (valueUs < SUB_BUCKETS_COUNT) {
+        return valueUs;
+    }
+    const size_t highestBit = 63 - __builtin_clzll(valueUs);
+    const size_t shift = highestBit - SUB_BUCKET_BITS;
+    const size_t subBucket = (valueUs >> shift) & (SUB_BUCKETS_COUNT - 1);
+    return std::min((shift + 1) * SUB_BUCKETS_COUNT + subBucket, BUCKETS_COUNT - 1);
+}
+
+uint64_t THistogram::GetBucketUpperBound(size_t bucket) {
+    if (bucket < SUB_BUCKETS_COUNT) {
+        return bucket;
+    }
+    const size_t shift = bucket / SUB_BUCKETS_COUNT - 1;
+    const uint64_t lowerBound = (SUB_BUCKETS_COUNT + bucket % SUB_BUCKETS_COUNT) << shift;
+    return lowerBound + (uint64_t(1) << shift) - 1;
+}
+
+TMetricsRegistry& TMetricsRegistry::Get() {
+    static TMetricsRegistry registry;
+    return registry;
+}
+
+template <class TMetric>
+TMetric& TMetricsRegistry::GetMetric(
+    std::map<std::string, TFamily<TMetric>>& families,
+    const std::string& name,
+    const std::string& help,
+    const TMetricLabels& labels)
+{
+    std::lock_guard<std::mutex> lock(Mutex);
+    const size_t typesCount = Counters.count(name) + Gauges.count(name) + Histograms.count(name);
+    ENSURE(typesCount == families.count(name), "Metric " + name + " is registered with another type");
+    TFamily<TMetric>& family = families[name];
+    family.Help = help;
+    std::unique_ptr<TMetric>& metric = family.Metrics[SerializeLabels(labels)];
+    if (!metric) {
+        metric = std::make_unique<TMetric>();
+    }
+    return *metric;
+}
+
+TCounter& TMetricsRegistry::GetCounter(const std::string& name, const std::string& help, const TMetricLabels& labels) {
+    return GetMetric(Counters, name, help, labels);
+}
+
+TGauge& TMetricsRegistry::GetGauge(const std::string& name, const std::string& help, const TMetricLabels& labels) {
+    return GetMetric(Gauges, name, help, labels);
+}
+
+THistogram& TMetricsRegistry::GetHistogram(const std::string& name, const std::string& help, const TMetricLabels& labels) {
+    return GetMetric(Histograms, name, help, labels);
+}
+
+std::string TMetricsRegistry::Serialize() const {
+    std::lock_guard<std::mutex> lock(Mutex);
+    std::string output;
+    for (const auto& [name, family] : Counters) {
+        WriteHeader(name, family.Help, "counter", output);
+        for (const auto& [labels, counter] : family.Metrics) {
+            WriteName(name, labels, "", output);
+            output += std::to_string(counter->Get());
+            output += '\n';
+        }
+    }
+    for (const auto& [name, family] : Gauges) {
+        WriteHeader(name, family.Help, "gauge", output);
+        for (const auto& [labels, gauge] : family.Metrics) {
+            WriteName(name, labels, "", output);
+            WriteDouble(gauge->Get(), output);
+            output += '\n';
+        }
+    }
+    for (const auto& [name, family] : Histograms) {
+        WriteHeader(name, family.Help, "histogram", output);
+        for (const auto& [labels, histogram] : family.Metrics) {
+            const THistogram::TSnapshot snapshot = histogram->GetSnapshot();
+            // Only the non-empty buckets are exported, the cumulative counts stay valid
+            uint64_t cumulativeCount = 0;
+            for (size_t bucket = 0; bucket < snapshot.Buckets.size(); ++bucket) {
+                if (snapshot.Buckets[bucket] == 0) {
+                    continue;
+                }
+                cumulativeCount += snapshot.Buckets[bucket];
+                std::string bound = "le=\"";
+                WriteDouble(THistogram::GetBucketUpperBound(bucket) / 1e6, bound);
+                bound += '"';
+                WriteName(name + "_bucket", labels, bound, output);
+                output += std::to_string(cumulativeCount);
+                output += '\n';
+            }
+            WriteName(name + "_bucket", labels, "le=\"+Inf\"", output);
+            output += std::to_string(cumulativeCount);
+            output += '\n';
+            WriteName(name + "_sum", labels, "", output);
+            WriteDouble(snapshot.Sum / 1e6, output);
+            output += '\n';
+            WriteName(name + "_count", labels, "", output);
+            output += std::to_string(cumulativeCount);
+            output += '\n';
+        }
+    }
+    return output;
+}
+
+THistogram& GetIndexStageHistogram(const std::string& stage) {
+    return TMetricsRegistry::Get().GetHistogram(
+        "newsbot_index_stage_duration_seconds",
+        "Time spent in the index build stages",
+        {{"stage", stage}});
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "timer.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Metrics for the hot paths, exported in the Prometheus text format.
+// Updates are relaxed atomic additions to one of the cache line aligned shards chosen by the thread
+// index. There are a couple of shards per hardware thread, but there may be more live threads than
+// shards, so threads may share a shard: the additions stay atomic, only the contention on the line grows.
+size_t GetMetricsShardsCount();
+
+class TCounter {
+public:
+    TCounter();
+
+    void Add(uint64_t value = 1);
+    uint64_t Get() const;
+
+private:
+    struct alignas(64) TShard {
+        std::atomic<uint64_t> Value {0};
+    };
+    std::unique_ptr<TShard[]> Shards;
+};
+
+class TGauge {
+public:
+    void Set(double value);
+    double Get() const;
+
+private:
+    std::atomic<double> Value {0.0};
+};
+
+// Log-linear histogram of durations in microseconds: every power of two is split into
+// SUB_BUCKETS_COUNT buckets, so a bucket bound is within 1 / SUB_BUCKETS_COUNT of any value in it.
+class THistogram {
+public:
+    static constexpr size_t SUB_BUCKET_BITS = 3;
+    static constexpr size_t SUB_BUCKETS_COUNT = 1 << SUB_BUCKET_BITS;
+    // Values up to 2^40 us (~12 days), larger ones go to the last bucket
+    static constexpr size_t MAX_VALUE_BITS = 40;
+    static constexpr size_t BUCKETS_COUNT = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS_COUNT;
+
+    struct TSnapshot {
+        std::vector<uint64_t> Buckets;
+        uint64_t Sum = 0;
+    };
+
+public:
+    THistogram();
+
+    void Record(uint64_t valueUs);
+    TSnapshot GetSnapshot() const;
+
+    static size_t GetBucket(uint64_t valueUs);
+    // Largest value of the bucket
+    static uint64_t GetBucketUpperBound(size_t bucket);
+
+private:
+    struct alignas(64) TShard {
+        std::array<std::atomic<uint64_t>, BUCKETS_COUNT> Buckets {};
+        std::atomic<uint64_t> Sum {0};
+    };
+    std::unique_ptr<TShard[]> Shards;
+};
+
+// Records the lifetime of the scope
+class TScopedLatency {
+public:
+    explicit TScopedLatency(THistogram& histogram)
+        : Histogram(histogram)
+    {
+    }
+
+    ~TScopedLatency() {
+        Histogram.Record(static_cast<uint64_t>(Timer.Elapsed()));
+    }
+
+private:
+    THistogram& Histogram;
+    TTimer<std::chrono::steady_clock, std::chrono::microseconds> Timer;
+};
+
+using TMetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+// Metrics are created once and never removed, so the returned references can be kept.
+// Creation takes a lock, hot paths should cache the references.
+class TMetricsRegistry {
+public:
+    static TMetricsRegistry& Get();
+
+    TCounter& GetCounter(const std::string& name, const std::string& help, const TMetricLabels& labels = {});
+    TGauge& GetGauge(const std::string& name, const std::string& help, const TMetricLabels& labels = {});
+    // Histograms are exported in seconds, so their names should end with _seconds
+    THistogram& GetHistogram(const std::string& name, const std::string& help, const TMetricLabels& labels = {});
+
+    std::string Serialize() const;
+
+private:
+    template <class TMetric>
+    struct TFamily {
+        std::string Help;
+        // Serialized labels to metrics
+        std::map<std::string, std::unique_ptr<TMetric>> Metrics;
+    };
+
+    template <class TMetric>
+    TMetric& GetMetric(
+        std::map<std::string, TFamily<TMetric>>& families,
+        const std::string& name,
+        const std::string& help,
+        const TMetricLabels& labels);
+
+private:
+    mutable std::mutex Mutex;
+    std::map<std::string, TFamily<TCounter>> Counters;
+    std::map<std::string, TFamily<TGauge>> Gauges;
+    std::map<std::string, TFamily<THistogram>> Histograms;
+};
+
+// Stages of the index build, languages are clustered and summarized concurrently, one value per language
+THistogram& GetIndexStageHistogram(const std::string& stage);
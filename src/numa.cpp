@@ -0,0 +1,66 @@
+#include "numa.h"
+
+#include "util.h"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <thread>
+
+namespace {
+    const std::string NODES_PATH = "/sys/devices/system/node";
+    const std::string NODE_PREFIX = "node";
+}
+
+std::vector<size_t> ParseCpuList(const std::string& cpuList) {
+    std::vector<size_t> cpus;
+    std::vector<std::string> ranges;
+    boost::split(ranges, boost::trim_copy(cpuList), boost::is_any_of(","), boost::token_compress_on);
+    for (const std::string& range : ranges) {
+        if (range.empty()) {
+            continue;
+        }
+        const size_t dashPos = range.find('-');
+        const size_t first = std::stoul(range.substr(0, dashPos));
+        const size_t last = dashPos == std::string::npos ? first : std::stoul(range.substr(dashPos + 1));
+        ENSURE(first <= last, "Bad CPU list: " << cpuList);
+        for (size_t cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+std::vector<TNumaNode> ProbeNumaTopology() {
+    std::vector<TNumaNode> nodes;
+    boost::system::error_code error;
+    for (boost::filesystem::directory_iterator it(NODES_PATH, error), end; !error && it != end; it.increment(error)) {
+        const std::string name = it->path().filename().string();
+        if (!boost::starts_with(name, NODE_PREFIX) || name.size() == NODE_PREFIX.size()
+            || !std::all_of(name.begin() + NODE_PREFIX.size(), name.end(), ::isdigit))
+        {
+            continue;
+        }
+        std::ifstream cpuListFile((it->path() / "cpulist").string());
+        std::string cpuList;
+        std::getline(cpuListFile, cpuList);
+        TNumaNode node;
+        node.Id = std::stoul(name.substr(NODE_PREFIX.size()));
+        node.Cpus = ParseCpuList(cpuList);
+        // Memory-only nodes have no CPUs to run on
+        if (!node.Cpus.empty()) {
+            nodes.push_back(std::move(node));
+        }
+    }
+    if (nodes.empty()) {
+        TNumaNode node;
+        for (size_t cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu) {
+            node.Cpus.push_back(cpu);
+        }
+        nodes.push_back(std::move(node));
+    }
+    std::sort(nodes.begin(), nodes.end(), [](const TNumaNode& a, const TNumaNode& b) { return a.Id < b.Id; });
+    return nodes;
+}
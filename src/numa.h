@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct TNumaNode {
+    size_t Id = 0;
+    std::vector<size_t> Cpus;
+};
+
+// Nodes with CPUs from /sys/devices/system/node, a single node with all the CPUs if there is no such directory
+std::vector<TNumaNode> ProbeNumaTopology();
+
+// Parses a sysfs CPU list like "0-3,8,10-11"
+std::vector<size_t> ParseCpuList(const std::string& cpuList);
@@ -1,22 +1,48 @@
 #include "ranker.h"
+#include "thread_pool.h"
 #include "util.h"
 
+#include <algorithm>
+
+namespace {
+
+// Weights are cheap, so only large inputs are split between the threads
+constexpr size_t RANK_GRAIN_SIZE = 4096;
+
+struct TRankedCluster {
+    double Weight = 0.;
+    size_t Size = 0;
+    size_t Index = 0;
+};
+
+}
+
 TWeightInfo ComputeClusterWeightPush(
-    const TNewsCluster& cluster,
+    const uint64_t bestTimestamp,
+    const double importance,
+    const size_t clusterSize,
     const uint64_t iterTimestamp,
     const uint64_t window
 ) {
     double timeMultiplier = 1.;
 
     // ~1 for freshest ts, 0.5 for 8 hour old ts, ~0 for 16 hour old ts
-    int32_t clusterTime = cluster.GetBestTimestamp();
+    int32_t clusterTime = bestTimestamp;
     if (clusterTime + window < iterTimestamp) {
         double clusterTimestampRemapped = static_cast<double>(clusterTime + static_cast<int32_t>(window) - static_cast<int32_t>(iterTimestamp)) / 3600.0 + 8.0;
         timeMultiplier = Sigmoid(clusterTimestampRemapped);
     }
 
-    double rank = cluster.GetImportance();
-    return TWeightInfo{clusterTime, rank, timeMultiplier, rank * timeMultiplier, cluster.GetSize()};
+    double rank = importance;
+    return TWeightInfo{clusterTime, rank, timeMultiplier, rank * timeMultiplier, clusterSize};
+}
+
+TWeightInfo ComputeClusterWeightPush(
+    const TNewsCluster& cluster,
+    const uint64_t iterTimestamp,
+    const uint64_t window
+) {
+    return ComputeClusterWeightPush(cluster.GetBestTimestamp(), cluster.GetImportance(), cluster.GetSize(), iterTimestamp, window);
 }
 
 TRanker::TRanker(const std::string& configPath) {
@@ -29,24 +55,21 @@ std::vector<std::vector<TWeightedNewsCluster>> TRanker::Rank(
     uint64_t iterTimestamp,
     uint64_t window
 ) const {
+    const size_t clustersCount = std::distance(begin, end);
+    std::vector<TWeightInfo> weights(clustersCount);
+    TThreadPool::GetShared().ParallelFor(0, clustersCount, [&](size_t index) {
+        weights[index] = ComputeClusterWeightPush(*(begin + index), iterTimestamp, window);
+    }, RANK_GRAIN_SIZE);
+
     std::vector<TWeightedNewsCluster> weightedClusters;
-    for (TClusters::const_iterator it = begin; it != end; it++) {
-        const TNewsCluster& cluster = *it;
-        const TWeightInfo weight = ComputeClusterWeightPush(cluster, iterTimestamp, window);
-        weightedClusters.emplace_back(cluster, std::move(weight));
+    weightedClusters.reserve(clustersCount);
+    for (size_t index = 0; index < clustersCount; ++index) {
+        weightedClusters.emplace_back(*(begin + index), weights[index]);
     }
 
     std::stable_sort(weightedClusters.begin(), weightedClusters.end(),
         [&](const TWeightedNewsCluster& a, const TWeightedNewsCluster& b) {
-            size_t firstSize = a.WeightInfo.ClusterSize;
-            size_t secondSize = b.WeightInfo.ClusterSize;
-            if (firstSize == secondSize) {
-                return a.WeightInfo.Weight > b.WeightInfo.Weight;
-            }
-            if (firstSize < this->Config.min_cluster_size() || secondSize < this->Config.min_cluster_size()) {
-                return firstSize > secondSize;
-            }
-            return a.WeightInfo.Weight > b.WeightInfo.Weight;
+            return IsRankedHigher(a.WeightInfo.Weight, a.WeightInfo.ClusterSize, b.WeightInfo.Weight, b.WeightInfo.ClusterSize);
         }
     );
 
@@ -60,3 +83,59 @@ std::vector<std::vector<TWeightedNewsCluster>> TRanker::Rank(
 
     return output;
 }
+
+std::vector<TWeightedNewsCluster> TRanker::RankTop(
+    const TClusters& clusters,
+    const TClusterSlice& slice,
+    uint64_t fromTimestamp,
+    uint64_t iterTimestamp,
+    uint64_t window,
+    size_t k
+) const {
+    const auto& timestamps = slice.FreshestTimestamps;
+    const size_t first = std::distance(
+        timestamps.begin(),
+        std::lower_bound(timestamps.begin(), timestamps.end(), fromTimestamp));
+
+    std::vector<TRankedCluster> rankedClusters;
+    rankedClusters.reserve(timestamps.size() - first);
+    for (size_t i = first; i < timestamps.size(); ++i) {
+        const TWeightInfo weight = ComputeClusterWeightPush(
+            slice.BestTimestamps[i], slice.Importances[i], slice.Sizes[i], iterTimestamp, window);
+        rankedClusters.push_back(TRankedCluster{weight.Weight, weight.ClusterSize, i});
+    }
+
+    // Ties are broken by the position, so the order is the same as after the stable sort in Rank
+    const size_t topSize = std::min(k, rankedClusters.size());
+    std::partial_sort(rankedClusters.begin(), rankedClusters.begin() + topSize, rankedClusters.end(),
+        [&](const TRankedCluster& a, const TRankedCluster& b) {
+            if (IsRankedHigher(a.Weight, a.Size, b.Weight, b.Size)) {
+                return true;
+            }
+            if (IsRankedHigher(b.Weight, b.Size, a.Weight, a.Size)) {
+                return false;
+            }
+            return a.Index < b.Index;
+        }
+    );
+
+    std::vector<TWeightedNewsCluster> output;
+    output.reserve(topSize);
+    for (size_t i = 0; i < topSize; ++i) {
+        const size_t index = rankedClusters[i].Index;
+        output.emplace_back(
+            clusters[slice.Indices[index]],
+            ComputeClusterWeightPush(slice.BestTimestamps[index], slice.Importances[index], slice.Sizes[index], iterTimestamp, window));
+    }
+    return output;
+}
+
+bool TRanker::IsRankedHigher(double firstWeight, size_t firstSize, double secondWeight, size_t secondSize) const {
+    if (firstSize == secondSize) {
+        return firstWeight > secondWeight;
+    }
+    if (firstSize < Config.min_cluster_size() || secondSize < Config.min_cluster_size()) {
+        return firstSize > secondSize;
+    }
+    return firstWeight > secondWeight;
+}
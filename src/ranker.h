@@ -38,6 +38,19 @@ public:
         uint64_t window
     ) const;
 
+    // First k clusters of the slice fresher than fromTimestamp, in the same order as in Rank
+    std::vector<TWeightedNewsCluster> RankTop(
+        const TClusters& clusters,
+        const TClusterSlice& slice,
+        uint64_t fromTimestamp,
+        uint64_t iterTimestamp,
+        uint64_t window,
+        size_t k
+    ) const;
+
+private:
+    bool IsRankedHigher(double firstWeight, size_t firstSize, double secondWeight, size_t secondSize) const;
+
 private:
     tg::TRankerConfig Config;
 };
@@ -5,7 +5,10 @@
 #include "clusterer.h"
 #include "config.pb.h"
 #include "controller.h"
+#include "executor.h"
+#include "metrics.h"
 #include "server_clustering.h"
+#include "trace.h"
 #include "util.h"
 
 #include <rocksdb/db.h>
@@ -23,6 +26,22 @@ namespace {
         return config;
     }
 
+    void UpdateIndexMetrics(const TClusterIndex& index) {
+        TMetricsRegistry& registry = TMetricsRegistry::Get();
+        registry.GetGauge("newsbot_index_generation", "Number of the served index").Set(index.Stats.Generation);
+        registry.GetGauge("newsbot_index_build_seconds", "Build time of the served index").Set(index.Stats.BuildTimeMs / 1000.0);
+        registry.GetGauge("newsbot_index_peak_rss_bytes", "Peak resident set size during the last index build")
+            .Set(index.Stats.PeakRssKb * 1024.0);
+        for (const auto& [language, docs] : index.Documents) {
+            registry.GetGauge("newsbot_index_documents", "Documents in the served index", {{"language", ToString(language)}})
+                .Set(docs.size());
+        }
+        for (const auto& [language, clusters] : index.Clusters) {
+            registry.GetGauge("newsbot_index_clusters", "Clusters in the served index", {{"language", ToString(language)}})
+                .Set(clusters.size());
+        }
+    }
+
     std::optional<uint32_t> GetOpenFileLimit() {
         rlimit limit;
         if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
@@ -78,6 +97,11 @@ int RunServer(const std::string& fname, uint16_t port) {
     LOG_DEBUG("Loading server config");
     const auto config = ParseConfig(fname);
     CheckIO(config);
+    if (config.tracing_enabled()) {
+        TTracer::Get().SetEnabled(true);
+    }
+    // Before the annotator, which would configure the executor with its own config
+    ConfigureExecutor(config.executor());
 
     LOG_DEBUG("Creating database");
     std::unique_ptr<rocksdb::DB> db = CreateDatabase(config);
@@ -106,22 +130,41 @@ int RunServer(const std::string& fname, uint16_t port) {
     LOG_DEBUG("Launching clustering");
     THotState<TClusterIndex> index;
 
+    TClusteringScheduler scheduler(
+        config.clusterer_min_changes(),
+        config.clusterer_quiet_period(),
+        config.clusterer_max_staleness());
+
     auto initContoller = [&, annotator=std::move(annotator)]() mutable {
-        DrClassMap::getSingleInstance<TController>()->Init(&index, db.get(), std::move(annotator), std::move(ranker));
+        DrClassMap::getSingleInstance<TController>()->Init(&index, &scheduler, db.get(), std::move(annotator), std::move(ranker));
     };
 
     std::thread clusteringThread([&, sleep_ms=config.clusterer_sleep()]() {
         bool firstRun = true;
+        TIndexStats indexStats;
+        // The previous generation is kept until the next build, which reuses its memory
+        std::unique_ptr<TClusterIndex> previousIndex;
         while (true) {
-            TClusterIndex newIndex = serverClustering.MakeIndex();
-            index.AtomicSet(std::make_shared<TClusterIndex>(std::move(newIndex)));
+            if (!firstRun && !scheduler.ShouldRebuild(CountPendingChanges(db.get(), indexStats))) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(sleep_ms));
+                continue;
+            }
+
+            scheduler.OnBuildStarted();
+            TClusterIndex newIndex = serverClustering.MakeIndex(std::move(previousIndex));
+            newIndex.ThreadsCache = std::make_unique<TThreadsCache>(
+                config.threads_cache_period_step(),
+                config.threads_cache_max_period());
+            newIndex.Stats.Generation = indexStats.Generation + 1;
+            indexStats = newIndex.Stats;
+            UpdateIndexMetrics(newIndex);
+            previousIndex = index.AtomicSet(std::make_unique<TClusterIndex>(std::move(newIndex)));
+            scheduler.OnIndexPublished();
 
             if (firstRun) {
                 initContoller();
                 firstRun = false;
             }
-
-            std::this_thread::sleep_for(std::chrono::milliseconds(sleep_ms));
         }
     });
 
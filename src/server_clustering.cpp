@@ -1,5 +1,8 @@
 #include "server_clustering.h"
 
+#include "metrics.h"
+#include "timer.h"
+#include "trace.h"
 #include "util.h"
 
 TServerClustering::TServerClustering(
@@ -15,13 +18,34 @@ TServerClustering::TServerClustering(
 
 namespace {
 
-    std::pair<std::vector<TDbDocument>, uint64_t> ReadDocs(rocksdb::DB* db) {
+    // Documents of the previous index keep their buffers, so parsing into them allocates much less
+    std::vector<TDbDocument> RecycleDocs(std::unique_ptr<TClusterIndex> index) {
+        TTraceSpan span("recycle_docs");
+        std::vector<TDbDocument> docs;
+        if (!index) {
+            return docs;
+        }
+        size_t docsCount = 0;
+        for (const auto& [_, langDocs] : index->Documents) {
+            docsCount += langDocs.size();
+        }
+        docs.reserve(docsCount);
+        for (auto& [_, langDocs] : index->Documents) {
+            std::move(langDocs.begin(), langDocs.end(), std::back_inserter(docs));
+        }
+        return docs;
+    }
+
+    // Documents, their max fetch time and the sequence number of the snapshot they are read from
+    std::tuple<std::vector<TDbDocument>, uint64_t, uint64_t> ReadDocs(rocksdb::DB* db, std::vector<TDbDocument>&& recycledDocs) {
+        TTraceSpan span("read_docs");
         rocksdb::ManagedSnapshot snapshot(db);
 
         rocksdb::ReadOptions ropt(/*cksum*/ true, /*cache*/ true);
         ropt.snapshot = snapshot.snapshot();
 
         std::vector<TDbDocument> docs;
+        docs.reserve(recycledDocs.size());
         uint64_t timestamp = 0;
 
         std::unique_ptr<rocksdb::Iterator> iter(db->NewIterator(ropt));
@@ -32,6 +56,10 @@ namespace {
             }
 
             TDbDocument doc;
+            if (!recycledDocs.empty()) {
+                doc = std::move(recycledDocs.back());
+                recycledDocs.pop_back();
+            }
             const bool succes = TDbDocument::ParseFromArray(value.data(), value.size(), &doc);
             if (!succes) {
                 LOG_DEBUG("Bad document in db: " << iter->key().ToString());
@@ -42,33 +70,112 @@ namespace {
             docs.push_back(std::move(doc));
         }
 
-        return std::make_pair(std::move(docs), timestamp);
+        return std::make_tuple(std::move(docs), timestamp, snapshot.snapshot()->GetSequenceNumber());
     }
 
-    void RemoveStaleDocs(rocksdb::DB* db, std::vector<TDbDocument>& docs, uint64_t timestamp) {
+    // Returns the number of deletions made
+    uint64_t RemoveStaleDocs(rocksdb::DB* db, std::vector<TDbDocument>& docs, uint64_t timestamp) {
+        TTraceSpan span("remove_stale_docs");
         rocksdb::WriteOptions wopt;
+        uint64_t removedCount = 0;
         for (const auto& doc : docs) {
             if (doc.IsStale(timestamp)) {
                 db->Delete(wopt, doc.FileName);
+                ++removedCount;
                 LOG_DEBUG("Removed: " << doc.FileName);
             }
         }
         docs.erase(std::remove_if(docs.begin(), docs.end(), [timestamp] (const auto& doc) { return doc.IsStale(timestamp); }), docs.end());
+        return removedCount;
+    }
+
+    uint64_t GetSteadyTimeMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
     }
 
 }
 
-TClusterIndex TServerClustering::MakeIndex() const {
-    auto [docs, timestamp] = ReadDocs(Db);
+TClusterIndex TServerClustering::MakeIndex(std::unique_ptr<TClusterIndex> previousIndex) const {
+    TTraceSpan span("make_index");
+    ResetPeakRss();
+
+    TTimer<std::chrono::high_resolution_clock, std::chrono::milliseconds> releaseTimer;
+    std::vector<TDbDocument> recycledDocs = RecycleDocs(std::move(previousIndex));
+    const uint64_t releaseTime = releaseTimer.Elapsed();
+
+    TTimer<std::chrono::high_resolution_clock, std::chrono::milliseconds> buildTimer;
+    TTimer<std::chrono::steady_clock, std::chrono::microseconds> stageTimer;
+    auto [docs, timestamp, sequenceNumber] = ReadDocs(Db, std::move(recycledDocs));
+    GetIndexStageHistogram("read").Record(stageTimer.Elapsed());
     LOG_DEBUG("Read " << docs.size() << " docs; timestamp: " << timestamp);
-    RemoveStaleDocs(Db, docs, timestamp);
 
-    TClusterIndex index = Clusterer->Cluster(std::move(docs));
+    stageTimer.Reset();
+    const uint64_t removedCount = RemoveStaleDocs(Db, docs, timestamp);
+    GetIndexStageHistogram("expire").Record(stageTimer.Elapsed());
+
+    TClusterIndex index = Clusterer->Cluster(std::move(docs), Summarizer.get());
 
-    for (auto& [lang, clusters] : index.Clusters) {
-        Summarizer->Summarize(clusters);
+    for (const auto& [lang, clusters] : index.Clusters) {
         LOG_DEBUG("Clustering output: " << ToString(lang) << " " << clusters.size() << " clusters");
     }
 
+    index.Stats.BuildTimeMs = buildTimer.Elapsed();
+    index.Stats.ReleaseTimeMs = releaseTime;
+    index.Stats.PeakRssKb = GetPeakRssKb();
+    index.Stats.DbSequenceNumber = sequenceNumber;
+    index.Stats.RemovedDocs = removedCount;
+    LOG_DEBUG("Index built in " << index.Stats.BuildTimeMs << " ms; previous index released in "
+        << index.Stats.ReleaseTimeMs << " ms; peak RSS " << index.Stats.PeakRssKb << " kB");
+
     return index;
 };
+
+uint64_t CountPendingChanges(rocksdb::DB* db, const TIndexStats& stats) {
+    // Every write takes one sequence number, the stale documents removal is accounted in the index already
+    const uint64_t indexedSequenceNumber = stats.DbSequenceNumber + stats.RemovedDocs;
+    const uint64_t latestSequenceNumber = db->GetLatestSequenceNumber();
+    return latestSequenceNumber > indexedSequenceNumber ? latestSequenceNumber - indexedSequenceNumber : 0;
+}
+
+TClusteringScheduler::TClusteringScheduler(uint64_t minChanges, uint64_t quietPeriodMs, uint64_t maxStalenessMs)
+    : MinChanges(minChanges)
+    , QuietPeriodMs(quietPeriodMs)
+    , MaxStalenessMs(maxStalenessMs)
+{
+}
+
+bool TClusteringScheduler::ShouldRebuild(uint64_t pendingChanges) {
+    const uint64_t nowMs = GetSteadyTimeMs();
+    if (pendingChanges == 0) {
+        LastPendingChanges = 0;
+        PendingSinceMs.store(0, std::memory_order_relaxed);
+        return false;
+    }
+    if (pendingChanges != LastPendingChanges) {
+        LastPendingChanges = pendingChanges;
+        LastChangeMs = nowMs;
+        if (PendingSinceMs.load(std::memory_order_relaxed) == 0) {
+            PendingSinceMs.store(nowMs, std::memory_order_relaxed);
+        }
+    }
+    if (nowMs - PendingSinceMs.load(std::memory_order_relaxed) >= MaxStalenessMs) {
+        return true;
+    }
+    return pendingChanges >= MinChanges && nowMs - LastChangeMs >= QuietPeriodMs;
+}
+
+void TClusteringScheduler::OnBuildStarted() {
+    BuildStartMs = GetSteadyTimeMs();
+}
+
+void TClusteringScheduler::OnIndexPublished() {
+    // Changes made during the build are not in the new index, they are at most that old
+    LastPendingChanges = 0;
+    PendingSinceMs.store(BuildStartMs, std::memory_order_relaxed);
+}
+
+uint64_t TClusteringScheduler::GetStalenessMs() const {
+    const uint64_t pendingSinceMs = PendingSinceMs.load(std::memory_order_relaxed);
+    return pendingSinceMs != 0 ? GetSteadyTimeMs() - pendingSinceMs : 0;
+}
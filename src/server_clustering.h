@@ -5,6 +5,8 @@
 
 #include <rocksdb/db.h>
 
+#include <atomic>
+
 class TServerClustering {
 public:
     TServerClustering(
@@ -13,10 +15,40 @@ public:
         rocksdb::DB* db
     );
 
-    TClusterIndex MakeIndex() const;
+    // Documents of the previous index are reused, its readers should be gone
+    TClusterIndex MakeIndex(std::unique_ptr<TClusterIndex> previousIndex = nullptr) const;
 
 private:
     const std::unique_ptr<TClusterer> Clusterer;
     const std::unique_ptr<TSummarizer> Summarizer;
     rocksdb::DB* Db;
 };
+
+// Number of database writes made after the snapshot of the index
+uint64_t CountPendingChanges(rocksdb::DB* db, const TIndexStats& stats);
+
+// Decides when the index should be rebuilt, so that an unchanged database is not clustered again.
+// The index is rebuilt when at least minChanges writes are pending and no new writes came during
+// the quiet period, which coalesces bursts, or when the oldest pending write waits for maxStalenessMs.
+class TClusteringScheduler {
+public:
+    TClusteringScheduler(uint64_t minChanges, uint64_t quietPeriodMs, uint64_t maxStalenessMs);
+
+    // Called by the clustering thread on each poll
+    bool ShouldRebuild(uint64_t pendingChanges);
+    void OnBuildStarted();
+    void OnIndexPublished();
+
+    // Age of the oldest write that is not in the served index, 0 if there are none; thread safe
+    uint64_t GetStalenessMs() const;
+
+private:
+    const uint64_t MinChanges = 1;
+    const uint64_t QuietPeriodMs = 0;
+    const uint64_t MaxStalenessMs = 0;
+
+    uint64_t LastPendingChanges = 0;
+    uint64_t LastChangeMs = 0;
+    uint64_t BuildStartMs = 0;
+    std::atomic<uint64_t> PendingSinceMs {0};
+};
@@ -1,5 +1,7 @@
 #include "summarizer.h"
 
+#include "thread_pool.h"
+#include "trace.h"
 #include "util.h"
 
 TSummarizer::TSummarizer(const std::string& configPath) {
@@ -18,12 +20,15 @@ TSummarizer::TSummarizer(const std::string& configPath) {
 }
 
 void TSummarizer::Summarize(TClusters& clusters) const {
-    for (TNewsCluster& cluster: clusters) {
+    TTraceSpan span("summarize");
+    TThreadPool::GetShared().ParallelFor(0, clusters.size(), [&](size_t index) {
+        TNewsCluster& cluster = clusters[index];
         assert(cluster.GetSize() > 0);
         cluster.Summarize(AgencyRating);
         cluster.CalcImportance(AlexaAgencyRating);
         cluster.CalcCategory();
-    }
+        cluster.SerializeArticles();
+    });
 }
 
 
@@ -1,59 +1,437 @@
-// Based on https://github.com/progschj/ThreadPool, altered to the project code style.
-//
-// Copyright (c) 2012 Jakob Progsch, Václav Zeman
-//
-// This software is provided 'as-is', without any express or implied
-// warranty. In no event will the authors be held liable for any damages
-// arising from the use of this software.
-
-// Permission is granted to anyone to use this software for any purpose,
-// including commercial applications, and to alter it and redistribute it
-// freely, subject to the following restrictions:
-
-// 1. The origin of this software must not be misrepresented; you must not
-// claim that you wrote the original software. If you use this software
-// in a product, an acknowledgment in the product documentation would be
-// appreciated but is not required.
-
-// 2. Altered source versions must be plainly marked as such, and must not be
-// misrepresented as being the original software.
-//
-// 3. This notice may not be removed or altered from any source
-// distribution.
-
 #include "thread_pool.h"
 
+#include "numa.h"
+#include "util.h"
 
-TThreadPool::TThreadPool(size_t threadsCount) {
-    for (size_t i = 0;i < threadsCount; ++i) {
-        Threads.emplace_back(
-            [this] {
-                while(true) {
-                    std::function<void()> task;
-                    {
-                        std::unique_lock<std::mutex> lock(Mutex);
-                        Condition.wait(lock, [this]{ return this->IsDone || !this->Tasks.empty(); });
-                        if (IsDone && Tasks.empty()) {
-                            return;
-                        }
-                        task = std::move(Tasks.front());
-                        Tasks.pop();
-                    }
-                    task();
-                }
+#include <unordered_map>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+    constexpr size_t INITIAL_DEQUE_CAPACITY = 256;
+    // Blocks are usually freed by the workers which ran the tasks, so the lists of the threads which
+    // only submit stay empty and those of the workers are capped
+    constexpr size_t MAX_FREE_BLOCKS = 1024;
+
+    thread_local const void* CurrentPool = nullptr;
+    thread_local size_t CurrentWorkerIndex = 0;
+
+    std::mutex SharedPoolMutex;
+    std::atomic<TThreadPool*> SharedPool {nullptr};
+    TThreadPoolOptions SharedPoolOptions;
+
+    void PinThread(std::thread& thread, const std::vector<size_t>& cpus) {
+#ifdef __linux__
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        for (size_t cpu : cpus) {
+            CPU_SET(cpu, &cpuSet);
+        }
+        const int error = pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuSet);
+        if (error != 0) {
+            LOG_ERROR("Could not pin a worker thread to CPU " << cpus.front() << ", error " << error);
+        }
+#else
+        UNUSED(thread);
+        UNUSED(cpus);
+#endif
+    }
+
+    struct TFreeBlock {
+        TFreeBlock* Next;
+    };
+
+    // Trivially destructible, so blocks freed by the destructors of other thread locals are still handled
+    thread_local TFreeBlock* FreeBlocks = nullptr;
+    thread_local size_t FreeBlocksCount = 0;
+    thread_local bool IsThreadExiting = false;
+
+    struct TFreeBlocksReleaser {
+        ~TFreeBlocksReleaser() {
+            IsThreadExiting = true;
+            while (FreeBlocks) {
+                TFreeBlock* block = FreeBlocks;
+                FreeBlocks = block->Next;
+                ::operator delete(block);
             }
-        );
+            FreeBlocksCount = 0;
+        }
+    };
+    thread_local TFreeBlocksReleaser FreeBlocksReleaser;
+
+    // Victims of the steals are picked at random so that idle workers do not all hit the same deque
+    size_t GetRandom() {
+        thread_local uint64_t state = std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return static_cast<size_t>(state);
+    }
+}
+
+void* TThreadPool::AllocateBlock() {
+    if (TFreeBlock* block = FreeBlocks) {
+        FreeBlocks = block->Next;
+        --FreeBlocksCount;
+        return block;
+    }
+    return ::operator new(BLOCK_SIZE);
+}
+
+void TThreadPool::DeallocateBlock(void* block) {
+    if (IsThreadExiting || FreeBlocksCount >= MAX_FREE_BLOCKS) {
+        ::operator delete(block);
+        return;
+    }
+    if (FreeBlocksCount == 0) {
+        // Makes sure the releaser of this thread is constructed
+        UNUSED(&FreeBlocksReleaser);
+    }
+    FreeBlocks = new (block) TFreeBlock{FreeBlocks};
+    ++FreeBlocksCount;
+}
+
+TThreadPool::TTask::~TTask() {
+    DestroyFunction(Function);
+}
+
+void TThreadPool::TTask::Run() {
+    static_assert(sizeof(TTask) <= BLOCK_SIZE, "Tasks should fit in the blocks");
+    if (!IsBlock) {
+        // The caller may destroy the task as soon as the call is done
+        CallFunction(Function);
+        return;
+    }
+    struct TRelease {
+        TTask* Task;
+        ~TRelease() {
+            Task->~TTask();
+            DeallocateBlock(Task);
+        }
+    } release{this};
+    CallFunction(Function);
+}
+
+TThreadPool::TWorkStealingDeque::TRing::TRing(size_t capacity)
+    : Mask(capacity - 1)
+    , Slots(std::make_unique<std::atomic<TTask*>[]>(capacity))
+{
+}
+
+TThreadPool::TWorkStealingDeque::TWorkStealingDeque() {
+    Rings.push_back(std::make_unique<TRing>(INITIAL_DEQUE_CAPACITY));
+    Ring.store(Rings.back().get(), std::memory_order_relaxed);
+}
+
+void TThreadPool::TWorkStealingDeque::Push(TTask* task) {
+    const int64_t bottom = Bottom.load(std::memory_order_relaxed);
+    const int64_t top = Top.load(std::memory_order_acquire);
+    TRing* ring = Ring.load(std::memory_order_relaxed);
+    if (bottom - top > static_cast<int64_t>(ring->Mask)) {
+        ring = Grow(ring, top, bottom);
+    }
+    ring->Slots[bottom & ring->Mask].store(task, std::memory_order_relaxed);
+    Bottom.store(bottom + 1, std::memory_order_release);
+}
+
+TThreadPool::TTask* TThreadPool::TWorkStealingDeque::Pop() {
+    const int64_t bottom = Bottom.load(std::memory_order_relaxed) - 1;
+    TRing* ring = Ring.load(std::memory_order_relaxed);
+    Bottom.store(bottom, std::memory_order_seq_cst);
+    int64_t top = Top.load(std::memory_order_seq_cst);
+    if (top > bottom) {
+        Bottom.store(bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    TTask* task = ring->Slots[bottom & ring->Mask].load(std::memory_order_relaxed);
+    if (top == bottom) {
+        // The last task, race with the thieves for it
+        if (!Top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            task = nullptr;
+        }
+        Bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return task;
+}
+
+TThreadPool::TTask* TThreadPool::TWorkStealingDeque::Steal() {
+    int64_t top = Top.load(std::memory_order_seq_cst);
+    const int64_t bottom = Bottom.load(std::memory_order_seq_cst);
+    if (top >= bottom) {
+        return nullptr;
+    }
+    TRing* ring = Ring.load(std::memory_order_acquire);
+    TTask* task = ring->Slots[top & ring->Mask].load(std::memory_order_relaxed);
+    if (!Top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        return nullptr;
+    }
+    return task;
+}
+
+bool TThreadPool::TWorkStealingDeque::IsEmpty() const {
+    return Bottom.load(std::memory_order_seq_cst) <= Top.load(std::memory_order_seq_cst);
+}
+
+TThreadPool::TWorkStealingDeque::TRing* TThreadPool::TWorkStealingDeque::Grow(TRing* ring, int64_t top, int64_t bottom) {
+    auto grown = std::make_unique<TRing>(2 * (ring->Mask + 1));
+    for (int64_t index = top; index < bottom; ++index) {
+        grown->Slots[index & grown->Mask].store(ring->Slots[index & ring->Mask].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    Rings.push_back(std::move(grown));
+    Ring.store(Rings.back().get(), std::memory_order_release);
+    return Rings.back().get();
+}
+
+bool TThreadPool::ConfigureShared(const TThreadPoolOptions& options) {
+    std::lock_guard<std::mutex> lock(SharedPoolMutex);
+    if (SharedPool.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    SharedPoolOptions = options;
+    return true;
+}
+
+TThreadPool& TThreadPool::GetShared() {
+    TThreadPool* pool = SharedPool.load(std::memory_order_acquire);
+    if (pool) {
+        return *pool;
+    }
+    std::lock_guard<std::mutex> lock(SharedPoolMutex);
+    pool = SharedPool.load(std::memory_order_relaxed);
+    if (!pool) {
+        // Never destroyed: thread locals of the workers may refer to singletons destroyed before it
+        pool = new TThreadPool(SharedPoolOptions);
+        SharedPool.store(pool, std::memory_order_release);
+    }
+    return *pool;
+}
+
+TThreadPool::TThreadPool(size_t threadsCount)
+    : TThreadPool(TThreadPoolOptions{threadsCount, {}, false})
+{
+}
+
+TThreadPool::TThreadPool(const TThreadPoolOptions& options) {
+    const size_t threadsCount = std::max<size_t>(1, options.ThreadsCount);
+    // All the deques exist before any worker starts stealing
+    for (size_t i = 0; i < threadsCount; ++i) {
+        Workers.push_back(std::make_unique<TWorker>());
+    }
+    const std::vector<std::vector<size_t>> workersCpus = PlaceWorkers(options);
+    for (size_t i = 0; i < threadsCount; ++i) {
+        Workers[i]->Thread = std::thread(&TThreadPool::WorkerLoop, this, i);
+        if (!workersCpus[i].empty()) {
+            PinThread(Workers[i]->Thread, workersCpus[i]);
+        }
     }
 }
 
 TThreadPool::~TThreadPool() {
     {
-        std::unique_lock<std::mutex> lock(Mutex);
+        std::lock_guard<std::mutex> lock(SleepMutex);
         IsDone = true;
     }
-    Condition.notify_all();
-    for(auto&& thread : Threads) {
-        thread.join();
+    SleepCondition.notify_all();
+    for (auto& worker : Workers) {
+        worker->Thread.join();
+    }
+}
+
+std::vector<std::vector<size_t>> TThreadPool::PlaceWorkers(const TThreadPoolOptions& options) {
+    std::vector<std::vector<size_t>> workersCpus(Workers.size());
+    if (!options.NumaAware) {
+        for (size_t i = 0; i < Workers.size() && !options.Cpus.empty(); ++i) {
+            workersCpus[i] = {options.Cpus[i % options.Cpus.size()]};
+        }
+    } else {
+        const std::vector<TNumaNode> topology = ProbeNumaTopology();
+        // CPUs of the pool grouped by node, nodes without them are skipped
+        std::vector<std::vector<size_t>> nodesCpus;
+        if (options.Cpus.empty()) {
+            for (const TNumaNode& node : topology) {
+                nodesCpus.push_back(node.Cpus);
+            }
+        } else {
+            std::unordered_map<size_t, size_t> cpuToNode;
+            for (size_t nodeIndex = 0; nodeIndex < topology.size(); ++nodeIndex) {
+                for (size_t cpu : topology[nodeIndex].Cpus) {
+                    cpuToNode[cpu] = nodeIndex;
+                }
+            }
+            std::vector<std::vector<size_t>> cpusByNode(topology.size());
+            for (size_t cpu : options.Cpus) {
+                const auto it = cpuToNode.find(cpu);
+                ENSURE(it != cpuToNode.end(), "CPU " << cpu << " is not in any NUMA node");
+                cpusByNode[it->second].push_back(cpu);
+            }
+            for (std::vector<size_t>& cpus : cpusByNode) {
+                if (!cpus.empty()) {
+                    nodesCpus.push_back(std::move(cpus));
+                }
+            }
+        }
+        const size_t nodesCount = std::min(nodesCpus.size(), Workers.size());
+        for (size_t i = 0; i < Workers.size(); ++i) {
+            const size_t node = i % nodesCount;
+            const std::vector<size_t>& nodeCpus = nodesCpus[node];
+            Workers[i]->Node = node;
+            // Without explicit CPUs a worker may run on any CPU of its node
+            workersCpus[i] = options.Cpus.empty() ? nodeCpus : std::vector<size_t>{nodeCpus[(i / nodesCount) % nodeCpus.size()]};
+        }
+        for (size_t node = 0; node < nodesCount; ++node) {
+            NodeQueues.push_back(std::make_unique<TInjectionQueue>());
+        }
+    }
+    for (size_t i = 0; i < Workers.size(); ++i) {
+        for (size_t j = 0; j < Workers.size(); ++j) {
+            if (i == j) {
+                continue;
+            }
+            auto& victims = Workers[i]->Node == Workers[j]->Node ? Workers[i]->NodeVictims : Workers[i]->RemoteVictims;
+            victims.push_back(j);
+        }
     }
+    return workersCpus;
 }
 
+void TThreadPool::TInjectionQueue::Push(TTask* task) {
+    std::lock_guard<std::mutex> lock(Mutex);
+    Tasks.push_back(task);
+    Size.fetch_add(1, std::memory_order_relaxed);
+}
+
+TThreadPool::TTask* TThreadPool::TInjectionQueue::Pop() {
+    if (Size.load(std::memory_order_relaxed) == 0) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(Mutex);
+    if (Tasks.empty()) {
+        return nullptr;
+    }
+    TTask* task = Tasks.front();
+    Tasks.pop_front();
+    Size.fetch_sub(1, std::memory_order_relaxed);
+    return task;
+}
+
+bool TThreadPool::TInjectionQueue::IsEmpty() const {
+    return Size.load(std::memory_order_seq_cst) == 0;
+}
+
+void TThreadPool::Submit(TTask* task, size_t node) {
+    const bool isBound = node != ANY_NODE && !NodeQueues.empty();
+    const size_t workerIndex = GetCurrentWorkerIndex();
+    if (isBound) {
+        NodeQueues[node % NodeQueues.size()]->Push(task);
+    } else if (workerIndex < Workers.size()) {
+        Workers[workerIndex]->Deque.Push(task);
+    } else {
+        SharedQueue.Push(task);
+    }
+    // Pairs with the one in WorkerLoop: either the worker sees the task or we see the worker sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (SleepingCount.load(std::memory_order_seq_cst) != 0) {
+        std::lock_guard<std::mutex> lock(SleepMutex);
+        ++WakeGeneration;
+        // A single woken worker may be of another node and unable to take a bound task
+        if (isBound) {
+            SleepCondition.notify_all();
+        } else {
+            SleepCondition.notify_one();
+        }
+    }
+}
+
+void TThreadPool::WorkerLoop(size_t workerIndex) {
+    CurrentPool = this;
+    CurrentWorkerIndex = workerIndex;
+    while (true) {
+        if (TTask* task = FindTask(workerIndex)) {
+            Run(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(SleepMutex);
+        SleepingCount.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (HasTasks(workerIndex)) {
+            SleepingCount.fetch_sub(1, std::memory_order_relaxed);
+            continue;
+        }
+        if (IsDone) {
+            SleepingCount.fetch_sub(1, std::memory_order_relaxed);
+            return;
+        }
+        const uint64_t generation = WakeGeneration;
+        SleepCondition.wait(lock, [this, generation] { return WakeGeneration != generation || IsDone; });
+        SleepingCount.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+size_t TThreadPool::GetCurrentWorkerIndex() const {
+    return CurrentPool == this ? CurrentWorkerIndex : Workers.size();
+}
+
+size_t TThreadPool::GetCurrentNode() const {
+    const size_t workerIndex = GetCurrentWorkerIndex();
+    return workerIndex < Workers.size() && !NodeQueues.empty() ? Workers[workerIndex]->Node : ANY_NODE;
+}
+
+TThreadPool::TTask* TThreadPool::FindTask(size_t workerIndex) {
+    const auto steal = [this](const std::vector<size_t>& victims) -> TTask* {
+        const size_t offset = victims.empty() ? 0 : GetRandom();
+        for (size_t i = 0; i < victims.size(); ++i) {
+            if (TTask* task = Workers[victims[(offset + i) % victims.size()]]->Deque.Steal()) {
+                return task;
+            }
+        }
+        return nullptr;
+    };
+
+    if (workerIndex >= Workers.size()) {
+        // Outside threads help with the shared tasks only, the bound ones are left to their nodes
+        if (TTask* task = SharedQueue.Pop()) {
+            return task;
+        }
+        const size_t offset = GetRandom();
+        for (size_t i = 0; i < Workers.size(); ++i) {
+            if (TTask* task = Workers[(offset + i) % Workers.size()]->Deque.Steal()) {
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    const TWorker& worker = *Workers[workerIndex];
+    if (TTask* task = Workers[workerIndex]->Deque.Pop()) {
+        return task;
+    }
+    if (!NodeQueues.empty()) {
+        if (TTask* task = NodeQueues[worker.Node]->Pop()) {
+            return task;
+        }
+    }
+    if (TTask* task = SharedQueue.Pop()) {
+        return task;
+    }
+    if (TTask* task = steal(worker.NodeVictims)) {
+        return task;
+    }
+    return steal(worker.RemoteVictims);
+}
+
+bool TThreadPool::HasTasks(size_t workerIndex) const {
+    if (!SharedQueue.IsEmpty()) {
+        return true;
+    }
+    if (!NodeQueues.empty() && !NodeQueues[Workers[workerIndex]->Node]->IsEmpty()) {
+        return true;
+    }
+    return std::any_of(Workers.begin(), Workers.end(), [](const auto& worker) { return !worker->Deque.IsEmpty(); });
+}
+
+void TThreadPool::Run(TTask* task) {
+    task->Run();
+}
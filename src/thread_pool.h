@@ -1,84 +1,373 @@
-// Based on https://github.com/progschj/ThreadPool, altered to the project code style.
-//
-// Copyright (c) 2012 Jakob Progsch, Václav Zeman
-//
-// This software is provided 'as-is', without any express or implied
-// warranty. In no event will the authors be held liable for any damages
-// arising from the use of this software.
-
-// Permission is granted to anyone to use this software for any purpose,
-// including commercial applications, and to alter it and redistribute it
-// freely, subject to the following restrictions:
-
-// 1. The origin of this software must not be misrepresented; you must not
-// claim that you wrote the original software. If you use this software
-// in a product, an acknowledgment in the product documentation would be
-// appreciated but is not required.
-
-// 2. Altered source versions must be plainly marked as such, and must not be
-// misrepresented as being the original software.
-//
-// 3. This notice may not be removed or altered from any source
-// distribution.
-
 #pragma once
 
-#include <vector>
-#include <queue>
-#include <memory>
-#include <thread>
-#include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
 #include <future>
-#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
+struct TThreadPoolOptions {
+    size_t ThreadsCount = std::thread::hardware_concurrency();
+    // Worker i is pinned to Cpus[i % Cpus.size()], workers are not pinned if empty
+    std::vector<size_t> Cpus;
+    // Workers are spread over the NUMA nodes round robin and pinned to the CPUs of their nodes
+    // (or to Cpus, if set). Idle workers steal from the same node first, and tasks may be bound to a node.
+    bool NumaAware = false;
+};
+
+// Work-stealing executor. Every worker owns a Chase-Lev deque: tasks spawned by a worker go to
+// the bottom of its deque and are taken from there LIFO, idle workers steal FIFO from the top of
+// the others. Tasks from outside threads go through a shared queue. Tasks and the states of their
+// futures are fixed size blocks recycled through thread local free lists, so a steady stream of
+// small tasks does not go to the allocator. The helpers of ParallelFor are not allocated at all.
 class TThreadPool {
 public:
-    // The constructor just launches some amount of workers
-    TThreadPool(size_t threadsCount=std::thread::hardware_concurrency());
+    explicit TThreadPool(size_t threadsCount = std::thread::hardware_concurrency());
+    explicit TThreadPool(const TThreadPoolOptions& options);
+    ~TThreadPool();
 
-    // Add new work item to the pool
-    template<class F, class... Args>
-    auto enqueue(F&& f, Args&&... args)
-        -> std::future<typename std::result_of<F(Args...)>::type>;
+    TThreadPool(const TThreadPool&) = delete;
+    TThreadPool& operator=(const TThreadPool&) = delete;
 
-    // The destructor joins all threads
-    ~TThreadPool();
+    // Process-wide pool for annotation, clustering, summarization and ranking. The options are
+    // applied only if the pool has not been created yet, returns whether they were.
+    static bool ConfigureShared(const TThreadPoolOptions& options);
+    static TThreadPool& GetShared();
+
+    static constexpr size_t ANY_NODE = std::numeric_limits<size_t>::max();
+
+    size_t GetThreadsCount() const { return Workers.size(); }
+    // NUMA nodes with workers, 1 if the pool is not NUMA aware
+    size_t GetNodesCount() const { return std::max<size_t>(1, NodeQueues.size()); }
+    // Node of the calling worker, ANY_NODE for outside threads and pools that are not NUMA aware
+    size_t GetCurrentNode() const;
+
+    template <class F, class... Args>
+    auto Enqueue(F&& function, Args&&... args) -> std::future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>;
+
+    // The task is run only by the workers of the node (node % GetNodesCount()), so the memory it
+    // touches first stays local to them. Same as Enqueue if the pool is not NUMA aware.
+    template <class F, class... Args>
+    auto EnqueueOnNode(size_t node, F&& function, Args&&... args) -> std::future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>;
+
+    // Calls function(i) for every i in [begin, end) and returns when all the calls are done.
+    // Chunks of grainSize indices (chosen from the range size if 0) are claimed dynamically,
+    // the calling thread takes part. The first exception is rethrown after the other chunks stop.
+    template <class F>
+    void ParallelFor(size_t begin, size_t end, F&& function, size_t grainSize = 0);
+
+    // Results of function(item) in the order of items; the result type should be default constructible
+    template <class T, class F>
+    auto ParallelMap(const std::vector<T>& items, F&& function, size_t grainSize = 0)
+        -> std::vector<std::invoke_result_t<F&, const T&>>;
+
+    // Runs other tasks while the future is not ready, so workers may wait for the tasks they spawned
+    template <class T>
+    T Wait(std::future<T>& future);
+
+private:
+    // Size of the recycled blocks, larger future states are left to the allocator
+    static constexpr size_t BLOCK_SIZE = 128;
+    static void* AllocateBlock();
+    static void DeallocateBlock(void* block);
+
+    template <class T>
+    class TBlockAllocator {
+    public:
+        using value_type = T;
+
+        TBlockAllocator() = default;
+        template <class U>
+        TBlockAllocator(const TBlockAllocator<U>&) {
+        }
+
+        T* allocate(size_t count) {
+            return IsBlock(count) ? static_cast<T*>(AllocateBlock()) : std::allocator<T>().allocate(count);
+        }
+
+        void deallocate(T* pointer, size_t count) {
+            if (IsBlock(count)) {
+                DeallocateBlock(pointer);
+            } else {
+                std::allocator<T>().deallocate(pointer, count);
+            }
+        }
+
+        template <class U>
+        bool operator==(const TBlockAllocator<U>&) const { return true; }
+        template <class U>
+        bool operator!=(const TBlockAllocator<U>&) const { return false; }
+
+    private:
+        static bool IsBlock(size_t count) {
+            return count == 1 && sizeof(T) <= BLOCK_SIZE && alignof(T) <= alignof(std::max_align_t);
+        }
+    };
+
+    // Callables up to INLINE_SIZE bytes are stored in the task itself, larger ones on the heap.
+    // Tasks made by Create live in blocks and are released after the run, others belong to the caller.
+    class TTask {
+    public:
+        static constexpr size_t INLINE_SIZE = 64;
+
+        template <class F>
+        static TTask* Create(F&& function);
+
+        template <class F>
+        TTask(F&& function, bool isBlock);
+        ~TTask();
+
+        TTask(const TTask&) = delete;
+        TTask& operator=(const TTask&) = delete;
+
+        void Run();
+
+    private:
+        template <class F>
+        static constexpr bool IsInline() {
+            return sizeof(F) <= INLINE_SIZE && alignof(F) <= alignof(std::max_align_t);
+        }
+
+    private:
+        alignas(std::max_align_t) unsigned char Storage[INLINE_SIZE];
+        void* Function = nullptr;
+        void (*CallFunction)(void* function) = nullptr;
+        void (*DestroyFunction)(void* function) = nullptr;
+        bool IsBlock = false;
+    };
+
+    // Chase-Lev deque, "Correct and Efficient Work-Stealing for Weak Memory Models", Le et al., 2013.
+    // Push and Pop are called by the owner only, Steal by any thread.
+    class TWorkStealingDeque {
+    public:
+        TWorkStealingDeque();
+
+        void Push(TTask* task);
+        TTask* Pop();
+        TTask* Steal();
+        bool IsEmpty() const;
+
+    private:
+        struct TRing {
+            explicit TRing(size_t capacity);
+
+            size_t Mask;
+            std::unique_ptr<std::atomic<TTask*>[]> Slots;
+        };
+
+        TRing* Grow(TRing* ring, int64_t top, int64_t bottom);
+
+    private:
+        alignas(64) std::atomic<int64_t> Top {0};
+        alignas(64) std::atomic<int64_t> Bottom {0};
+        std::atomic<TRing*> Ring;
+        // Thieves may still read a replaced ring, so rings live as long as the deque
+        std::vector<std::unique_ptr<TRing>> Rings;
+    };
+
+    struct TWorker {
+        TWorkStealingDeque Deque;
+        std::thread Thread;
+        size_t Node = 0;
+        // Workers to steal from, those of the same node are tried first
+        std::vector<size_t> NodeVictims;
+        std::vector<size_t> RemoteVictims;
+    };
+
+    class TInjectionQueue {
+    public:
+        void Push(TTask* task);
+        TTask* Pop();
+        bool IsEmpty() const;
+
+    private:
+        mutable std::mutex Mutex;
+        std::deque<TTask*> Tasks;
+        std::atomic<size_t> Size {0};
+    };
 
 private:
-    // Need to keep track of threads so we can join them
-    std::vector<std::thread> Threads;
-    // The task queue
-    std::queue<std::function<void()>> Tasks;
-
-    // Synchronization
-    std::mutex Mutex;
-    std::condition_variable Condition;
+    // Assigns the nodes of the workers and returns the CPUs to pin each of them to
+    std::vector<std::vector<size_t>> PlaceWorkers(const TThreadPoolOptions& options);
+    void Submit(TTask* task, size_t node = ANY_NODE);
+    void WorkerLoop(size_t workerIndex);
+    // Index of the calling thread among the workers, GetThreadsCount() for outside threads
+    size_t GetCurrentWorkerIndex() const;
+    TTask* FindTask(size_t workerIndex);
+    bool HasTasks(size_t workerIndex) const;
+    // Runs other tasks until the predicate is true, so that a waiting worker does not block its own deque
+    template <class TPredicate>
+    void HelpWhile(TPredicate&& isWaiting);
+    static void Run(TTask* task);
+
+private:
+    std::vector<std::unique_ptr<TWorker>> Workers;
+
+    // Tasks of the threads outside of the pool
+    TInjectionQueue SharedQueue;
+    // Tasks bound to the nodes, empty if the pool is not NUMA aware
+    std::vector<std::unique_ptr<TInjectionQueue>> NodeQueues;
+
+    std::mutex SleepMutex;
+    std::condition_variable SleepCondition;
+    std::atomic<size_t> SleepingCount {0};
+    uint64_t WakeGeneration = 0;
     bool IsDone = false;
 };
 
-template<class F, class... Args>
-auto TThreadPool::enqueue(F&& f, Args&&... args)
-    -> std::future<typename std::result_of<F(Args...)>::type>
+template <class F>
+TThreadPool::TTask* TThreadPool::TTask::Create(F&& function) {
+    void* block = AllocateBlock();
+    try {
+        return new (block) TTask(std::forward<F>(function), true);
+    } catch (...) {
+        DeallocateBlock(block);
+        throw;
+    }
+}
+
+template <class F>
+TThreadPool::TTask::TTask(F&& function, bool isBlock)
+    : IsBlock(isBlock)
 {
-    using return_type = typename std::result_of<F(Args...)>::type;
+    using TFunction = std::decay_t<F>;
+    if constexpr (IsInline<TFunction>()) {
+        Function = new (Storage) TFunction(std::forward<F>(function));
+        DestroyFunction = [](void* function) { static_cast<TFunction*>(function)->~TFunction(); };
+    } else {
+        Function = new TFunction(std::forward<F>(function));
+        DestroyFunction = [](void* function) { delete static_cast<TFunction*>(function); };
+    }
+    CallFunction = [](void* function) { (*static_cast<TFunction*>(function))(); };
+}
 
-    auto task = std::make_shared< std::packaged_task<return_type()> >(
-        std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-    );
+template <class F, class... Args>
+auto TThreadPool::Enqueue(F&& function, Args&&... args) -> std::future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> {
+    return EnqueueOnNode(ANY_NODE, std::forward<F>(function), std::forward<Args>(args)...);
+}
 
-    std::future<return_type> res = task->get_future();
-    {
-        std::unique_lock<std::mutex> lock(Mutex);
+template <class F, class... Args>
+auto TThreadPool::EnqueueOnNode(size_t node, F&& function, Args&&... args) -> std::future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> {
+    using TResult = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
+    std::promise<TResult> promise(std::allocator_arg, TBlockAllocator<TResult>());
+    std::future<TResult> future = promise.get_future();
+    auto call = [promise = std::move(promise), function = std::forward<F>(function), args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+        try {
+            if constexpr (std::is_void_v<TResult>) {
+                std::apply(function, std::move(args));
+                promise.set_value();
+            } else {
+                promise.set_value(std::apply(function, std::move(args)));
+            }
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+    };
+    Submit(TTask::Create(std::move(call)), node);
+    return future;
+}
 
-        // Don't allow enqueueing after stopping the pool
-        if (IsDone) {
-            throw std::runtime_error("enqueue on stopped TThreadPool");
+template <class F>
+void TThreadPool::ParallelFor(size_t begin, size_t end, F&& function, size_t grainSize) {
+    if (begin >= end) {
+        return;
+    }
+    const size_t count = end - begin;
+    if (grainSize == 0) {
+        // A few chunks per thread to balance uneven items
+        grainSize = std::max<size_t>(1, count / (8 * (Workers.size() + 1)));
+    }
+    const size_t chunksCount = (count + grainSize - 1) / grainSize;
+
+    std::atomic<size_t> nextIndex {begin};
+    std::atomic<size_t> runningHelpers {0};
+    std::exception_ptr exception;
+    std::mutex exceptionMutex;
+    const auto processChunks = [&]() {
+        while (true) {
+            const size_t chunkBegin = nextIndex.fetch_add(grainSize, std::memory_order_relaxed);
+            if (chunkBegin >= end) {
+                return;
+            }
+            const size_t chunkEnd = std::min(end, chunkBegin + grainSize);
+            try {
+                for (size_t index = chunkBegin; index < chunkEnd; ++index) {
+                    function(index);
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(exceptionMutex);
+                if (!exception) {
+                    exception = std::current_exception();
+                }
+                nextIndex.store(end, std::memory_order_relaxed);
+            }
         }
+    };
+
+    // In a NUMA-aware pool the chunks of a worker stay on its node
+    const size_t node = GetCurrentNode();
+    const size_t helpersLimit = node != ANY_NODE ? Workers[GetCurrentWorkerIndex()]->NodeVictims.size() : Workers.size();
+    const size_t helpersCount = std::min(helpersLimit, chunksCount - 1);
+    runningHelpers.store(helpersCount, std::memory_order_relaxed);
+    // All the helpers run the same task. It stays on this stack, as every submitted copy is run before
+    // the counter drops to zero, and a task of the caller is not touched after its call returns.
+    TTask helper([&processChunks, &runningHelpers]() {
+        processChunks();
+        runningHelpers.fetch_sub(1, std::memory_order_release);
+    }, false);
+    for (size_t i = 0; i < helpersCount; ++i) {
+        Submit(&helper, node);
+    }
+    processChunks();
+    HelpWhile([&runningHelpers]() { return runningHelpers.load(std::memory_order_acquire) != 0; });
 
-        Tasks.emplace([task](){ (*task)(); });
+    if (exception) {
+        std::rethrow_exception(exception);
     }
-    Condition.notify_one();
-    return res;
 }
 
+template <class T, class F>
+auto TThreadPool::ParallelMap(const std::vector<T>& items, F&& function, size_t grainSize)
+    -> std::vector<std::invoke_result_t<F&, const T&>>
+{
+    std::vector<std::invoke_result_t<F&, const T&>> results(items.size());
+    ParallelFor(0, items.size(), [&](size_t index) {
+        results[index] = function(items[index]);
+    }, grainSize);
+    return results;
+}
+
+template <class T>
+T TThreadPool::Wait(std::future<T>& future) {
+    HelpWhile([&future]() { return future.wait_for(std::chrono::seconds(0)) != std::future_status::ready; });
+    return future.get();
+}
+
+template <class TPredicate>
+void TThreadPool::HelpWhile(TPredicate&& isWaiting) {
+    size_t idleRounds = 0;
+    while (isWaiting()) {
+        TTask* task = FindTask(GetCurrentWorkerIndex());
+        if (task) {
+            Run(task);
+            idleRounds = 0;
+        } else if (++idleRounds < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+}
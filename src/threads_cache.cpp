@@ -0,0 +1,56 @@
+#include "threads_cache.h"
+
+#include <cassert>
+
+TThreadsCache::TThreadsCache(uint64_t periodStep, uint64_t maxPeriod)
+    : PeriodStep(periodStep)
+    , MaxPeriod(maxPeriod)
+    , BucketsCount(periodStep != 0 ? maxPeriod / periodStep + 2 : 0)
+{
+    const size_t slotsCount = tg::ELanguage_ARRAYSIZE * tg::ECategory_ARRAYSIZE * BucketsCount;
+    Slots = std::make_unique<std::atomic<const std::string*>[]>(slotsCount);
+    for (size_t i = 0; i < slotsCount; ++i) {
+        Slots[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+TThreadsCache::~TThreadsCache() {
+    const size_t slotsCount = tg::ELanguage_ARRAYSIZE * tg::ECategory_ARRAYSIZE * BucketsCount;
+    for (size_t i = 0; i < slotsCount; ++i) {
+        delete Slots[i].load(std::memory_order_relaxed);
+    }
+}
+
+std::optional<uint64_t> TThreadsCache::GetCachedPeriod(uint64_t period) const {
+    if (PeriodStep == 0 || period > MaxPeriod) {
+        return std::nullopt;
+    }
+    return (period + PeriodStep - 1) / PeriodStep * PeriodStep;
+}
+
+const std::string* TThreadsCache::Get(tg::ELanguage language, tg::ECategory category, uint64_t cachedPeriod) const {
+    return Slots[GetSlot(language, category, cachedPeriod)].load(std::memory_order_acquire);
+}
+
+const std::string* TThreadsCache::Insert(
+    tg::ELanguage language,
+    tg::ECategory category,
+    uint64_t cachedPeriod,
+    std::string response
+) {
+    std::atomic<const std::string*>& slot = Slots[GetSlot(language, category, cachedPeriod)];
+    const std::string* newResponse = new std::string(std::move(response));
+    const std::string* oldResponse = nullptr;
+    if (slot.compare_exchange_strong(oldResponse, newResponse, std::memory_order_acq_rel)) {
+        return newResponse;
+    }
+    delete newResponse;
+    return oldResponse;
+}
+
+size_t TThreadsCache::GetSlot(tg::ELanguage language, tg::ECategory category, uint64_t cachedPeriod) const {
+    assert(PeriodStep != 0 && cachedPeriod % PeriodStep == 0);
+    const size_t bucket = cachedPeriod / PeriodStep;
+    assert(bucket < BucketsCount);
+    return (static_cast<size_t>(language) * tg::ECategory_ARRAYSIZE + static_cast<size_t>(category)) * BucketsCount + bucket;
+}
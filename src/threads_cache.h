@@ -0,0 +1,38 @@
+#pragma once
+
+#include "enum.pb.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+// Serialized /threads responses of one index generation.
+// Requested periods are rounded up to a multiple of the period step, so the number of responses is bounded.
+// Lookups are lock-free, a slot is filled once and is never changed afterwards.
+class TThreadsCache {
+public:
+    TThreadsCache(uint64_t periodStep, uint64_t maxPeriod);
+    ~TThreadsCache();
+
+    TThreadsCache(const TThreadsCache&) = delete;
+    TThreadsCache& operator=(const TThreadsCache&) = delete;
+
+    // Period that should be used instead of the requested one, nullopt if the period is not cached
+    std::optional<uint64_t> GetCachedPeriod(uint64_t period) const;
+
+    const std::string* Get(tg::ELanguage language, tg::ECategory category, uint64_t cachedPeriod) const;
+
+    // Returns the cached response, which may be the one inserted by a concurrent request
+    const std::string* Insert(tg::ELanguage language, tg::ECategory category, uint64_t cachedPeriod, std::string response);
+
+private:
+    size_t GetSlot(tg::ELanguage language, tg::ECategory category, uint64_t cachedPeriod) const;
+
+private:
+    uint64_t PeriodStep = 0;
+    uint64_t MaxPeriod = 0;
+    size_t BucketsCount = 0;
+    std::unique_ptr<std::atomic<const std::string*>[]> Slots;
+};
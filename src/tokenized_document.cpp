@@ -0,0 +1,61 @@
+#include "tokenized_document.h"
+
+#include <algorithm>
+
+TTokenizedDocument::TTokenizedDocument(const std::vector<std::string>& titleTokens, const std::vector<std::string>& textTokens) {
+    size_t length = 1;
+    for (const std::vector<std::string>* tokens : {&titleTokens, &textTokens}) {
+        for (const std::string& token : *tokens) {
+            length += token.size() + 1;
+        }
+    }
+    Buffer.reserve(length);
+    Spans.reserve(titleTokens.size() + textTokens.size() + 2);
+
+    AddField(titleTokens);
+    TitleLength = Buffer.size();
+    TitleWordsCount = Spans.size();
+    Buffer += ' ';
+    AddField(textTokens);
+}
+
+void TTokenizedDocument::AddField(const std::vector<std::string>& tokens) {
+    const size_t fieldBegin = Buffer.size();
+    const size_t firstSpan = Spans.size();
+    for (const std::string& token : tokens) {
+        if (token.empty()) {
+            continue;
+        }
+        if (Buffer.size() != fieldBegin) {
+            Buffer += ' ';
+        }
+        Spans.push_back({Buffer.size(), token.size()});
+        Buffer += token;
+    }
+    if (Spans.size() == firstSpan) {
+        Spans.push_back({fieldBegin, 0});
+    }
+}
+
+std::string_view TTokenizedDocument::Get(tg::EEmbedderField field) const {
+    const std::string_view buffer(Buffer);
+    if (field == tg::EF_TITLE) {
+        return buffer.substr(0, TitleLength);
+    } else if (field == tg::EF_TEXT) {
+        return buffer.substr(std::min(TitleLength + 1, buffer.size()));
+    } else if (field == tg::EF_ALL) {
+        return buffer;
+    }
+    return {};
+}
+
+TTokenizedDocument::TWords TTokenizedDocument::GetWords(tg::EEmbedderField field) const {
+    if (field == tg::EF_TITLE) {
+        return TWords(Buffer.data(), Spans.data(), TitleWordsCount);
+    } else if (field == tg::EF_TEXT) {
+        return TWords(Buffer.data(), Spans.data() + TitleWordsCount, Spans.size() - TitleWordsCount);
+    } else if (field == tg::EF_ALL) {
+        return TWords(Buffer.data(), Spans.data(), Spans.size());
+    }
+    return TWords(Buffer.data(), Spans.data(), 0);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "enum.pb.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Preprocessed title and text, tokenized once per document and shared by the category detector
+// and all the embedders. The tokens are joined by spaces in one buffer, the title first, so the
+// fields are views into it and nobody joins, splits or concatenates the texts again.
+class TTokenizedDocument {
+private:
+    struct TSpan {
+        size_t Offset = 0;
+        size_t Length = 0;
+    };
+
+public:
+    // Words of a field, views into the buffer of the document
+    class TWords {
+    public:
+        size_t Size() const { return Count; }
+        std::string_view operator[](size_t index) const {
+            return std::string_view(Buffer + Spans[index].Offset, Spans[index].Length);
+        }
+
+    private:
+        friend class TTokenizedDocument;
+        TWords(const char* buffer, const TSpan* spans, size_t count)
+            : Buffer(buffer)
+            , Spans(spans)
+            , Count(count)
+        {
+        }
+
+    private:
+        const char* Buffer;
+        const TSpan* Spans;
+        size_t Count;
+    };
+
+public:
+    TTokenizedDocument() = default;
+    // Empty tokens are dropped, the tokens are expected to have no spaces
+    TTokenizedDocument(const std::vector<std::string>& titleTokens, const std::vector<std::string>& textTokens);
+
+    // Tokens joined by spaces, the title and the text are separated by a space for EF_ALL
+    std::string_view Get(tg::EEmbedderField field) const;
+    // Same words as splitting Get(field) by spaces: an empty title or text is a single empty word
+    TWords GetWords(tg::EEmbedderField field) const;
+
+private:
+    void AddField(const std::vector<std::string>& tokens);
+
+private:
+    std::string Buffer;
+    std::vector<TSpan> Spans;
+    size_t TitleLength = 0;
+    size_t TitleWordsCount = 0;
+};
@@ -0,0 +1,114 @@
+#include "trace.h"
+
+#include "json_writer.h"
+#include "util.h"
+
+#include <algorithm>
+#include <fstream>
+
+TTracer::TThreadBufferHolder::TThreadBufferHolder(TTracer& tracer)
+    : Tracer(tracer)
+    , Buffer(tracer.AcquireBuffer())
+{
+}
+
+TTracer::TThreadBufferHolder::~TThreadBufferHolder() {
+    Tracer.ReleaseBuffer(Buffer);
+}
+
+void TTracer::SetEnabled(bool enabled) {
+    Enabled.store(enabled, std::memory_order_relaxed);
+}
+
+uint64_t TTracer::GetTimestampUs() const {
+    return static_cast<uint64_t>(Clock.Elapsed());
+}
+
+void TTracer::Record(const char* name, uint64_t beginUs, uint64_t endUs) {
+    TThreadBuffer& buffer = GetThreadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.Mutex);
+    buffer.Events[buffer.Recorded % RING_SIZE] = {name, beginUs, endUs - beginUs, GetThreadIndex()};
+    ++buffer.Recorded;
+}
+
+std::string TTracer::ExportJson(size_t maxThreadSpans) const {
+    std::vector<TEvent> events;
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        for (const auto& buffer : Buffers) {
+            std::lock_guard<std::mutex> bufferLock(buffer->Mutex);
+            const size_t count = std::min({buffer->Recorded, RING_SIZE, maxThreadSpans});
+            for (size_t index = buffer->Recorded - count; index < buffer->Recorded; ++index) {
+                events.push_back(buffer->Events[index % RING_SIZE]);
+            }
+        }
+    }
+
+    std::string output;
+    output.reserve(events.size() * 96 + 64);
+    TJsonWriter writer(output);
+    writer.BeginObject().Key("displayTimeUnit").String("ms").Key("traceEvents").BeginArray();
+    for (const TEvent& event : events) {
+        writer.BeginObject()
+            .Key("name").String(event.Name)
+            .Key("cat").String("newsbot")
+            .Key("ph").String("X")
+            .Key("ts").Int(event.BeginUs)
+            .Key("dur").Int(event.DurationUs)
+            .Key("pid").Int(1)
+            .Key("tid").Int(event.ThreadIndex)
+            .EndObject();
+    }
+    writer.EndArray().EndObject();
+    return output;
+}
+
+void TTracer::Clear() {
+    std::lock_guard<std::mutex> lock(Mutex);
+    for (const auto& buffer : Buffers) {
+        std::lock_guard<std::mutex> bufferLock(buffer->Mutex);
+        buffer->Recorded = 0;
+    }
+}
+
+TTracer::TThreadBuffer& TTracer::GetThreadBuffer() {
+    thread_local TThreadBufferHolder holder(*this);
+    return *holder.Buffer;
+}
+
+TTracer::TThreadBuffer* TTracer::AcquireBuffer() {
+    std::lock_guard<std::mutex> lock(Mutex);
+    if (!FreeBuffers.empty()) {
+        TThreadBuffer* buffer = FreeBuffers.back();
+        FreeBuffers.pop_back();
+        return buffer;
+    }
+    Buffers.push_back(std::make_unique<TThreadBuffer>());
+    Buffers.back()->Events.resize(RING_SIZE);
+    return Buffers.back().get();
+}
+
+void TTracer::ReleaseBuffer(TThreadBuffer* buffer) {
+    std::lock_guard<std::mutex> lock(Mutex);
+    FreeBuffers.push_back(buffer);
+}
+
+TTraceSession::TTraceSession(const std::string& path)
+    : Path(path)
+{
+    if (!Path.empty()) {
+        TTracer::Get().SetEnabled(true);
+    }
+}
+
+TTraceSession::~TTraceSession() {
+    if (Path.empty()) {
+        return;
+    }
+    TTracer::Get().SetEnabled(false);
+    std::ofstream output(Path);
+    output << TTracer::Get().ExportJson();
+    if (!output) {
+        LOG_ERROR("Could not write the trace to " << Path);
+    }
+}
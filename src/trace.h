@@ -0,0 +1,111 @@
+#pragma once
+
+#include "timer.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Spans are recorded into per-thread ring buffers and exported in the Chrome trace event format,
+// which chrome://tracing and Perfetto open. Span names must be string literals, only pointers are stored.
+// With tracing disabled a span costs a single relaxed load.
+class TTracer {
+public:
+    static constexpr size_t RING_SIZE = 1 << 15;
+
+    static TTracer& Get() {
+        static TTracer tracer;
+        return tracer;
+    }
+
+    void SetEnabled(bool enabled);
+    bool IsEnabled() const {
+        return Enabled.load(std::memory_order_relaxed);
+    }
+
+    // Microseconds since the tracer creation
+    uint64_t GetTimestampUs() const;
+    void Record(const char* name, uint64_t beginUs, uint64_t endUs);
+
+    // Latest spans of every thread, at most RING_SIZE of them
+    std::string ExportJson(size_t maxThreadSpans = RING_SIZE) const;
+    void Clear();
+
+private:
+    struct TEvent {
+        const char* Name = nullptr;
+        uint64_t BeginUs = 0;
+        uint64_t DurationUs = 0;
+        size_t ThreadIndex = 0;
+    };
+
+    struct TThreadBuffer {
+        // Taken by the owner thread on every record, contended only by the export
+        std::mutex Mutex;
+        std::vector<TEvent> Events;
+        size_t Recorded = 0;
+    };
+
+    // Returns the buffer of a finished thread to the pool, so short-lived pools do not grow the memory
+    struct TThreadBufferHolder {
+        explicit TThreadBufferHolder(TTracer& tracer);
+        ~TThreadBufferHolder();
+
+        TTracer& Tracer;
+        TThreadBuffer* Buffer = nullptr;
+    };
+
+private:
+    TTracer() = default;
+
+    TThreadBuffer& GetThreadBuffer();
+    TThreadBuffer* AcquireBuffer();
+    void ReleaseBuffer(TThreadBuffer* buffer);
+
+private:
+    std::atomic<bool> Enabled {false};
+    const TTimer<std::chrono::steady_clock, std::chrono::microseconds> Clock;
+
+    mutable std::mutex Mutex;
+    // Released buffers keep their spans until they are reused
+    std::vector<std::unique_ptr<TThreadBuffer>> Buffers;
+    std::vector<TThreadBuffer*> FreeBuffers;
+};
+
+class TTraceSpan {
+public:
+    explicit TTraceSpan(const char* name)
+        : Name(TTracer::Get().IsEnabled() ? name : nullptr)
+        , BeginUs(Name ? TTracer::Get().GetTimestampUs() : 0)
+    {
+    }
+
+    ~TTraceSpan() {
+        if (Name) {
+            TTracer& tracer = TTracer::Get();
+            tracer.Record(Name, BeginUs, tracer.GetTimestampUs());
+        }
+    }
+
+    TTraceSpan(const TTraceSpan&) = delete;
+    TTraceSpan& operator=(const TTraceSpan&) = delete;
+
+private:
+    const char* Name;
+    const uint64_t BeginUs;
+};
+
+// Enables tracing for the lifetime of the object and writes the trace to the file at the end.
+// Does nothing for an empty path.
+class TTraceSession {
+public:
+    explicit TTraceSession(const std::string& path);
+    ~TTraceSession();
+
+private:
+    std::string Path;
+};
@@ -1,6 +1,12 @@
+#include <atomic>
 #include <cmath>
 #include <ctime>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <queue>
 #include <regex>
+#include <string_view>
 
 #include <boost/filesystem.hpp>
 
@@ -46,6 +52,69 @@ std::string CleanFileName(const std::string& fileName) {
     return fileName.substr(fileName.find_last_of("/") + 1);
 }
 
+uint64_t GetPeakRssKb() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        static constexpr std::string_view PREFIX = "VmHWM:";
+        if (line.compare(0, PREFIX.size(), PREFIX) == 0) {
+            return std::stoull(line.substr(PREFIX.size()));
+        }
+    }
+    return 0;
+}
+
+void ResetPeakRss() {
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+}
+
+namespace {
+    struct TThreadIndices {
+        std::mutex Mutex;
+        size_t Count = 0;
+        std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>> Free;
+    };
+
+    // Never destroyed, threads may exit after the static destructors
+    TThreadIndices& GetThreadIndices() {
+        static TThreadIndices* indices = new TThreadIndices;
+        return *indices;
+    }
+
+    // Trivially destructible, so it stays readable in the destructors of other thread locals
+    thread_local size_t ThreadIndex = NO_THREAD_INDEX;
+    thread_local bool IsThreadIndexReleased = false;
+
+    struct TThreadIndexHolder {
+        TThreadIndexHolder() {
+            TThreadIndices& indices = GetThreadIndices();
+            std::lock_guard<std::mutex> lock(indices.Mutex);
+            if (indices.Free.empty()) {
+                ThreadIndex = indices.Count++;
+            } else {
+                ThreadIndex = indices.Free.top();
+                indices.Free.pop();
+            }
+        }
+
+        ~TThreadIndexHolder() {
+            TThreadIndices& indices = GetThreadIndices();
+            std::lock_guard<std::mutex> lock(indices.Mutex);
+            indices.Free.push(ThreadIndex);
+            ThreadIndex = NO_THREAD_INDEX;
+            IsThreadIndexReleased = true;
+        }
+    };
+}
+
+size_t GetThreadIndex() {
+    if (ThreadIndex == NO_THREAD_INDEX && !IsThreadIndexReleased) {
+        thread_local TThreadIndexHolder holder;
+    }
+    return ThreadIndex;
+}
+
 float Sigmoid(float x) {
     if (x >= 0.0f) {
         float z = exp(-x);
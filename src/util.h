@@ -6,6 +6,7 @@
 #include <google/protobuf/text_format.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 #include <iomanip>
+#include <limits>
 #include <nlohmann_json/json.hpp>
 
 #include <string>
@@ -75,6 +76,18 @@ std::string GetHost(const std::string& url);
 // Get name of the file without a path to it
 std::string CleanFileName(const std::string& fileName);
 
+// Peak resident set size of the process in kB, 0 if it is not available
+uint64_t GetPeakRssKb();
+
+// Resets the peak resident set size to the current one (Linux only)
+void ResetPeakRss();
+
+// Dense index of the calling thread, assigned on the first call. Indices of the exited threads are
+// given to the new ones, smallest first. Destructors of thread locals that run after the index is
+// released get NO_THREAD_INDEX.
+constexpr size_t NO_THREAD_INDEX = std::numeric_limits<size_t>::max();
+size_t GetThreadIndex();
+
 // Stable sigmoids
 float Sigmoid(float x);
 double Sigmoid(double x);
@@ -0,0 +1,75 @@
+#define BOOST_TEST_DYN_LINK
+
+#define BOOST_TEST_MODULE "RankerModule"
+
+#define STR_EXPAND(tok) #tok
+#define STR(tok) STR_EXPAND(tok)
+
+#include "../src/ranker.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <random>
+
+BOOST_AUTO_TEST_CASE( rank_top )
+{
+    const char* rankerConfig = STR(TEST_PATH)"/../configs/ranker.pbtxt";
+    const TRanker ranker(rankerConfig);
+
+    const uint64_t iterTimestamp = 1600000000;
+    const uint64_t window = 3600 * 24;
+    std::mt19937 generator(42);
+
+    std::vector<TDbDocument> docs(3000);
+    for (size_t i = 0; i < docs.size(); ++i) {
+        TDbDocument& doc = docs[i];
+        doc.Host = "host" + std::to_string(generator() % 20) + ".com";
+        doc.Url = "https://" + doc.Host + "/" + std::to_string(i);
+        doc.Title = "title" + std::to_string(i);
+        doc.FetchTime = iterTimestamp - generator() % (2 * window);
+        doc.Language = tg::LN_EN;
+        doc.Category = static_cast<tg::ECategory>(tg::NC_SOCIETY + generator() % (tg::NC_OTHER - tg::NC_SOCIETY + 1));
+        doc.Embeddings[tg::EK_FASTTEXT_CLASSIC] = {1.f, static_cast<float>(generator() % 10)};
+    }
+
+    // Many small clusters of the same size, so that there are plenty of ties
+    TClusters clusters;
+    const TAgencyRating agencyRating;
+    const TAlexaAgencyRating alexaRating;
+    for (size_t i = 0; i < docs.size();) {
+        const size_t clusterSize = std::min<size_t>(1 + generator() % 6, docs.size() - i);
+        TNewsCluster cluster(clusters.size());
+        for (size_t j = 0; j < clusterSize; ++j) {
+            cluster.AddDocument(docs[i + j]);
+        }
+        cluster.Summarize(agencyRating);
+        cluster.CalcImportance(alexaRating);
+        cluster.CalcCategory();
+        clusters.push_back(std::move(cluster));
+        i += clusterSize;
+    }
+
+    std::stable_sort(clusters.begin(), clusters.end(),
+        [](const TNewsCluster& a, const TNewsCluster& b) {
+            return a.GetFreshestTimestamp() < b.GetFreshestTimestamp();
+        }
+    );
+    const TClusterSlices slices = SliceByCategory(clusters);
+    BOOST_REQUIRE_EQUAL(slices.size(), tg::ECategory_ARRAYSIZE);
+
+    for (uint64_t period : {3600, 3600 * 8, 3600 * 24 * 3}) {
+        const uint64_t fromTimestamp = iterTimestamp - period;
+        const auto begin = std::lower_bound(clusters.cbegin(), clusters.cend(), fromTimestamp, TNewsCluster::Compare);
+        const auto ranked = ranker.Rank(begin, clusters.cend(), iterTimestamp, period);
+        for (size_t category = 0; category < ranked.size(); ++category) {
+            for (size_t k : {0, 1, 10, 100, 10000}) {
+                const auto top = ranker.RankTop(clusters, slices[category], fromTimestamp, iterTimestamp, period, k);
+                BOOST_REQUIRE_EQUAL(top.size(), std::min(k, ranked[category].size()));
+                for (size_t i = 0; i < top.size(); ++i) {
+                    BOOST_REQUIRE_EQUAL(&top[i].Cluster.get(), &ranked[category][i].Cluster.get());
+                    BOOST_REQUIRE_EQUAL(top[i].WeightInfo.Weight, ranked[category][i].WeightInfo.Weight);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,131 @@
+#define BOOST_TEST_DYN_LINK
+
+#define BOOST_TEST_MODULE "ThreadPoolModule"
+
+#include "../src/thread_pool.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <array>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+BOOST_AUTO_TEST_CASE( parallel_map_order )
+{
+    TThreadPool pool(4);
+    std::vector<size_t> items(10000);
+    std::iota(items.begin(), items.end(), 0);
+    for (size_t grainSize : {0, 1, 7, 20000}) {
+        const std::vector<std::string> results = pool.ParallelMap(items, [](size_t item) {
+            return std::to_string(item * item);
+        }, grainSize);
+        BOOST_REQUIRE_EQUAL(results.size(), items.size());
+        for (size_t i = 0; i < items.size(); ++i) {
+            BOOST_CHECK_EQUAL(results[i], std::to_string(i * i));
+        }
+    }
+    BOOST_CHECK(pool.ParallelMap(std::vector<size_t>(), [](size_t item) { return item; }).empty());
+}
+
+BOOST_AUTO_TEST_CASE( nested_parallel_for )
+{
+    // Fewer workers than outer chunks, so the waiting ones have to run the inner chunks themselves
+    TThreadPool pool(2);
+    constexpr size_t OUTER = 64;
+    constexpr size_t INNER = 1000;
+    std::vector<std::atomic<size_t>> sums(OUTER);
+    pool.ParallelFor(0, OUTER, [&](size_t i) {
+        pool.ParallelFor(0, INNER, [&](size_t j) {
+            sums[i].fetch_add(j, std::memory_order_relaxed);
+        }, 10);
+    }, 1);
+    for (size_t i = 0; i < OUTER; ++i) {
+        BOOST_CHECK_EQUAL(sums[i].load(), INNER * (INNER - 1) / 2);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( wait_inside_task )
+{
+    // A single worker waits for the tasks it spawned, they are run by the waiting worker itself
+    TThreadPool pool(1);
+    auto future = pool.Enqueue([&pool]() {
+        std::vector<std::future<size_t>> futures;
+        for (size_t i = 0; i < 100; ++i) {
+            futures.push_back(pool.Enqueue([](size_t value) { return value * 2; }, i));
+        }
+        size_t sum = 0;
+        for (auto& future : futures) {
+            sum += pool.Wait(future);
+        }
+        return sum;
+    });
+    BOOST_CHECK_EQUAL(pool.Wait(future), 9900);
+}
+
+BOOST_AUTO_TEST_CASE( first_exception_rethrow )
+{
+    TThreadPool pool(4);
+    std::atomic<size_t> calls {0};
+    BOOST_CHECK_THROW(pool.ParallelFor(0, 100000, [&](size_t i) {
+        calls.fetch_add(1, std::memory_order_relaxed);
+        if (i % 1000 == 999) {
+            throw std::runtime_error("index " + std::to_string(i));
+        }
+    }, 100), std::runtime_error);
+    // The other chunks stop once an exception is caught
+    BOOST_CHECK_LT(calls.load(), 100000);
+
+    auto future = pool.Enqueue([]() -> int { throw std::logic_error("task"); });
+    BOOST_CHECK_THROW(pool.Wait(future), std::logic_error);
+
+    // The pool is still usable
+    std::atomic<size_t> sum {0};
+    pool.ParallelFor(0, 100, [&](size_t i) { sum.fetch_add(i, std::memory_order_relaxed); });
+    BOOST_CHECK_EQUAL(sum.load(), 4950);
+}
+
+BOOST_AUTO_TEST_CASE( sleeping_workers_wake_up )
+{
+    TThreadPool pool(4);
+    for (size_t round = 0; round < 20; ++round) {
+        // Let the workers fall asleep, the task must wake one of them as nobody helps
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        auto future = pool.Enqueue([round]() { return round; });
+        BOOST_REQUIRE(future.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+        BOOST_CHECK_EQUAL(future.get(), round);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( concurrent_submitters )
+{
+    TThreadPool pool(4);
+    constexpr size_t THREADS = 4;
+    constexpr size_t TASKS = 5000;
+    std::vector<std::thread> threads;
+    std::array<size_t, THREADS> sums {};
+    for (size_t t = 0; t < THREADS; ++t) {
+        threads.emplace_back([&pool, &sums, t]() {
+            // Callables larger than the inline storage of a task are kept on the heap
+            std::array<size_t, 32> payload {};
+            payload.back() = t;
+            std::vector<std::future<size_t>> futures;
+            for (size_t i = 0; i < TASKS; ++i) {
+                if (i % 2 == 0) {
+                    futures.push_back(pool.Enqueue([i]() { return i; }));
+                } else {
+                    futures.push_back(pool.Enqueue([i, payload]() { return i + payload.back() - payload.back(); }));
+                }
+            }
+            for (auto& future : futures) {
+                sums[t] += pool.Wait(future);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    for (size_t sum : sums) {
+        BOOST_CHECK_EQUAL(sum, TASKS * (TASKS - 1) / 2);
+    }
+}
@@ -0,0 +1,100 @@
+#define BOOST_TEST_DYN_LINK
+
+#define BOOST_TEST_MODULE "TokenIndexerModule"
+
+#define STR_EXPAND(tok) #tok
+#define STR(tok) STR_EXPAND(tok)
+
+#include "../src/embedders/token_indexer.h"
+#include "../src/tokenized_document.h"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <fstream>
+#include <unordered_map>
+
+namespace {
+    const char* VOCABULARY_PATH = STR(TEST_PATH)"/data/vocabulary.txt";
+
+    // Indexing as it was done with boost::split and token_compress_on, which the embedder models were trained with
+    std::vector<size_t> ReferenceIndex(const std::string& text, size_t maxWords) {
+        std::unordered_map<std::string, size_t> vocabulary;
+        std::ifstream vocabularyFile(VOCABULARY_PATH);
+        std::string line;
+        for (size_t wordIndex = 0; std::getline(vocabularyFile, line); ++wordIndex) {
+            vocabulary[line.substr(0, line.find('\t'))] = wordIndex;
+        }
+        std::vector<std::string> words;
+        boost::split(words, text, boost::is_any_of(" "), boost::token_compress_on);
+        words.resize(std::min(words.size(), maxWords));
+        std::vector<size_t> result;
+        for (const std::string& word : words) {
+            const auto it = vocabulary.find(word);
+            result.push_back(it != vocabulary.end() ? it->second : 0);
+        }
+        return result;
+    }
+
+    std::vector<size_t> ToVector(const torch::Tensor& tensor) {
+        const int64_t* data = tensor.data_ptr<int64_t>();
+        return std::vector<size_t>(data, data + tensor.size(0));
+    }
+}
+
+BOOST_AUTO_TEST_CASE( index_text )
+{
+    const TTokenIndexer indexer(VOCABULARY_PATH, 100);
+    BOOST_CHECK_EQUAL(indexer.Size(), 6);
+
+    // The last duplicate of "the" wins
+    const std::vector<size_t> expected = {4, 2, 3, 5, 4, 6, 0};
+    const std::vector<size_t> indices = indexer.Index("the cat sat on the mat dog");
+    BOOST_CHECK_EQUAL_COLLECTIONS(indices.begin(), indices.end(), expected.begin(), expected.end());
+
+    for (const std::string text : {"", " ", "   ", "the", " the", "the ", "  the   cat  ", "cat  sat on  ", "dog cat"}) {
+        const std::vector<size_t> reference = ReferenceIndex(text, 100);
+        const std::vector<size_t> indices = indexer.Index(text);
+        BOOST_CHECK_EQUAL_COLLECTIONS(indices.begin(), indices.end(), reference.begin(), reference.end());
+        const std::vector<size_t> torchIndices = ToVector(indexer.IndexTorch(text));
+        BOOST_CHECK_EQUAL_COLLECTIONS(torchIndices.begin(), torchIndices.end(), reference.begin(), reference.end());
+    }
+}
+
+BOOST_AUTO_TEST_CASE( index_max_words )
+{
+    const std::string text = " the cat  sat on the mat ";
+    for (size_t maxWords : {0, 1, 2, 5, 8, 9}) {
+        const TTokenIndexer indexer(VOCABULARY_PATH, maxWords);
+        const std::vector<size_t> reference = ReferenceIndex(text, maxWords);
+        const std::vector<size_t> indices = indexer.Index(text);
+        BOOST_CHECK_EQUAL_COLLECTIONS(indices.begin(), indices.end(), reference.begin(), reference.end());
+    }
+    BOOST_CHECK(TTokenIndexer(VOCABULARY_PATH, 0).Index("").empty());
+}
+
+BOOST_AUTO_TEST_CASE( index_tokenized_document )
+{
+    const std::vector<std::vector<std::string>> fields = {{}, {"the"}, {"cat", "sat", "dog"}};
+    for (const auto& titleTokens : fields) {
+        for (const auto& textTokens : fields) {
+            const TTokenizedDocument document(titleTokens, textTokens);
+            for (tg::EEmbedderField field : {tg::EF_TITLE, tg::EF_TEXT, tg::EF_ALL}) {
+                for (size_t maxWords : {0, 1, 2, 100}) {
+                    const TTokenIndexer indexer(VOCABULARY_PATH, maxWords);
+                    const std::vector<size_t> reference = ReferenceIndex(std::string(document.Get(field)), maxWords);
+                    const std::vector<size_t> indices = indexer.Index(document.GetWords(field));
+                    BOOST_CHECK_EQUAL_COLLECTIONS(indices.begin(), indices.end(), reference.begin(), reference.end());
+                    const std::vector<size_t> torchIndices = ToVector(indexer.IndexTorch(document.GetWords(field)));
+                    BOOST_CHECK_EQUAL_COLLECTIONS(torchIndices.begin(), torchIndices.end(), reference.begin(), reference.end());
+                }
+            }
+        }
+    }
+
+    // An empty field is a single empty word, as splitting an empty string gives
+    const TTokenizedDocument document({}, {"the", "cat"});
+    const std::vector<size_t> expected = {0};
+    const std::vector<size_t> indices = TTokenIndexer(VOCABULARY_PATH, 100).Index(document.GetWords(tg::EF_TITLE));
+    BOOST_CHECK_EQUAL_COLLECTIONS(indices.begin(), indices.end(), expected.begin(), expected.end());
+}